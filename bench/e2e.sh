@@ -0,0 +1,103 @@
+#!/bin/sh
+# Author - zebubull
+# e2e.sh
+# Times cbuild end to end on a generated project.
+# Copyright (c) zebubull 2023
+#
+# usage: bench/e2e.sh [-n files] [-d depth] [-H headers] [-f fan-in] [-s functions]
+#                     [-j jobs] [-o results.csv] <cbuild binary>
+#
+# The project options are passed on to gen.sh. Five builds are timed in order:
+#
+#   cold    full build from nothing
+#   noop    nothing changed (best of 3)
+#   touch   one translation unit edited
+#   header  one header edited, rebuilds everything including it
+#   flag    a define added to the config
+#
+# Results are written as CSV to stdout and to the -o file if one is given,
+# one row per build with the number of translation units that got compiled.
+# Use a release build of cbuild, the debug allocator tracking skews the numbers.
+
+set -e
+
+GEN_ARGS=
+JOBS=
+OUT=
+
+while getopts n:d:H:f:s:j:o: opt; do
+    case "$opt" in
+        n|d|H|f|s) GEN_ARGS="$GEN_ARGS -$opt $OPTARG" ;;
+        j) JOBS="-j $OPTARG" ;;
+        o) OUT=$OPTARG ;;
+        *) echo "usage: $0 [-n files] [-d depth] [-H headers] [-f fan-in] [-s functions] [-j jobs] [-o results.csv] <cbuild binary>" >&2; exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+if [ $# -ne 1 ]; then
+    echo "usage: $0 [-n files] [-d depth] [-H headers] [-f fan-in] [-s functions] [-j jobs] [-o results.csv] <cbuild binary>" >&2
+    exit 1
+fi
+
+BENCH=$(cd "$(dirname "$0")" && pwd)
+CBUILD=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+
+if [ -n "$OUT" ]; then
+    OUT=$(cd "$(dirname "$OUT")" && pwd)/$(basename "$OUT")
+fi
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+# shellcheck disable=SC2086
+"$BENCH/gen.sh" $GEN_ARGS "$WORK/project"
+cd "$WORK/project"
+
+# Runs one build, sets SECONDS_TAKEN and COMPILED
+run_build() {
+    start=$(date +%s.%N)
+    # shellcheck disable=SC2086
+    "$CBUILD" $JOBS release > "$WORK/log" 2>&1 || { cat "$WORK/log" >&2; exit 1; }
+    end=$(date +%s.%N)
+    SECONDS_TAKEN=$(awk "BEGIN { print $end - $start }")
+    COMPILED=$(grep -c '^\[CMD\] .* -c ' "$WORK/log" || true)
+}
+
+RESULTS="scenario,seconds,compiled"
+
+record() {
+    RESULTS="$RESULTS
+$1,$SECONDS_TAKEN,$COMPILED"
+}
+
+run_build
+record cold
+
+best=
+for i in 1 2 3; do
+    run_build
+    if [ -z "$best" ] || awk "BEGIN { exit !($SECONDS_TAKEN < $best) }"; then
+        best=$SECONDS_TAKEN
+    fi
+done
+SECONDS_TAKEN=$best
+record noop
+
+echo "int bench_touched(void) { return 1; }" >> src/main.c
+run_build
+record touch
+
+echo "#define BENCH_TOUCHED 1" >> src/include/h0.h
+run_build
+record header
+
+printf 'define BENCH_FLAG\n' >> cbuild
+run_build
+record flag
+
+echo "$RESULTS"
+
+if [ -n "$OUT" ]; then
+    echo "$RESULTS" > "$OUT"
+fi
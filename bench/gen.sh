@@ -0,0 +1,99 @@
+#!/bin/sh
+# Author - zebubull
+# gen.sh
+# Generates a synthetic C project for benchmarking cbuild.
+# Copyright (c) zebubull 2023
+#
+# usage: bench/gen.sh [-n files] [-d depth] [-H headers] [-f fan-in] [-s functions] <directory>
+#
+#   -n  number of translation units (default 1000)
+#   -d  how many directories deep the sources are nested (default 2)
+#   -H  number of shared headers (default 50)
+#   -f  headers included by each translation unit (default 5)
+#   -s  functions defined in each translation unit (default 10)
+#
+# Sources are spread 100 to a directory. Every translation unit includes
+# `fan-in` of the headers, picked so each header is included about as often,
+# and the project links into a working executable.
+
+set -e
+
+FILES=1000
+DEPTH=2
+HEADERS=50
+FANIN=5
+FUNCS=10
+
+while getopts n:d:H:f:s: opt; do
+    case "$opt" in
+        n) FILES=$OPTARG ;;
+        d) DEPTH=$OPTARG ;;
+        H) HEADERS=$OPTARG ;;
+        f) FANIN=$OPTARG ;;
+        s) FUNCS=$OPTARG ;;
+        *) echo "usage: $0 [-n files] [-d depth] [-H headers] [-f fan-in] [-s functions] <directory>" >&2; exit 1 ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+if [ $# -ne 1 ]; then
+    echo "usage: $0 [-n files] [-d depth] [-H headers] [-f fan-in] [-s functions] <directory>" >&2
+    exit 1
+fi
+
+if [ "$FANIN" -gt "$HEADERS" ]; then
+    FANIN=$HEADERS
+fi
+
+ROOT=$1
+mkdir -p "$ROOT/src/include"
+
+printf 'source src\nproject bench\nflag -Isrc/include\n\nrule debug\ndefine DEBUG\nflag -g\nendrule\n\nrule release\ndefine RELEASE\nflag -O2\nendrule\n' > "$ROOT/cbuild"
+
+# Awk does the heavy lifting, a shell loop writing 100k files takes forever
+awk -v root="$ROOT" -v files="$FILES" -v depth="$DEPTH" -v headers="$HEADERS" -v fanin="$FANIN" -v funcs="$FUNCS" '
+function dir_for(i,    k, path, level) {
+    k = int(i / 100)
+    path = root "/src"
+    for (level = 0; level < depth; ++level) {
+        path = path "/d" (level == depth - 1 ? k : k % 10)
+        k = int(k / 10)
+    }
+    return path
+}
+BEGIN {
+    for (h = 0; h < headers; ++h) {
+        out = root "/src/include/h" h ".h"
+        printf "#pragma once\n\n" > out
+        printf "typedef struct h%d_state { int value; int count; } h%d_state_t;\n\n", h, h > out
+        printf "static inline int h%d_step(h%d_state_t *state, int x) {\n", h, h > out
+        printf "    state->value = state->value * 31 + x;\n    return ++state->count;\n}\n" > out
+        close(out)
+    }
+
+    made[""] = 1
+    for (i = 0; i < files; ++i) {
+        dir = dir_for(i)
+        if (!(dir in made)) {
+            system("mkdir -p \"" dir "\"")
+            made[dir] = 1
+        }
+
+        out = dir "/f" i ".c"
+        for (j = 0; j < fanin; ++j) {
+            printf "#include \"h%d.h\"\n", (i + j * int(headers / fanin + 1)) % headers > out
+        }
+        h = i % headers
+        printf "\n" > out
+        for (j = 0; j < funcs; ++j) {
+            printf "int f%d_%d(int x) {\n    h%d_state_t state = {0, 0};\n", i, j, h > out
+            printf "    for (int k = 0; k < x; ++k) h%d_step(&state, k ^ %d);\n", h, j > out
+            printf "    return state.value;\n}\n\n" > out
+        }
+        close(out)
+    }
+
+    out = root "/src/main.c"
+    printf "int f0_0(int x);\n\nint main(int argc, char **argv) {\n    return f0_0(argc) & 1;\n}\n" > out
+    close(out)
+}'
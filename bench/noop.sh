@@ -0,0 +1,81 @@
+#!/bin/sh
+# Author - zebubull
+# noop.sh
+# Times a no-op build of generated projects with 1k, 10k and 100k source files.
+# Copyright (c) zebubull 2023
+#
+# usage: bench/noop.sh <cbuild binary> [file counts...]
+#
+# A stand-in gcc is put on the PATH so populating the timetable doesn't take
+# hours, it only creates the files cbuild expects to see and answers the
+# toolchain probe with a made up version. Use a release build
+# of cbuild, the debug allocator tracking skews the numbers.
+
+set -e
+
+if [ $# -lt 1 ]; then
+    echo "usage: $0 <cbuild binary> [file counts...]" >&2
+    exit 1
+fi
+
+CBUILD=$(cd "$(dirname "$1")" && pwd)/$(basename "$1")
+shift
+
+if [ $# -eq 0 ]; then
+    set -- 1000 10000 100000
+fi
+
+WORK=$(mktemp -d)
+trap 'rm -rf "$WORK"' EXIT
+
+mkdir -p "$WORK/bin"
+cat > "$WORK/bin/gcc" <<'EOF'
+#!/bin/sh
+out=
+dep=
+src=
+while [ $# -gt 0 ]; do
+    case "$1" in
+        --version|-Wl,--version) echo "gcc (cbuild bench) 0.0.0"; exit 0 ;;
+        -o) out=$2; shift ;;
+        -MF) dep=$2; shift ;;
+        *.c) src=$1 ;;
+    esac
+    shift
+done
+if [ -n "$out" ]; then
+    : > "$out"
+fi
+if [ -n "$dep" ]; then
+    echo "$out: $src" > "$dep"
+fi
+EOF
+chmod +x "$WORK/bin/gcc"
+
+echo "files,noop_seconds"
+
+for count in "$@"; do
+    project="$WORK/p$count"
+    mkdir -p "$project/src"
+    printf 'source src\nproject bench\n' > "$project/cbuild"
+
+    # 100 files per directory
+    i=0
+    while [ $i -lt "$count" ]; do
+        dir="$project/src/d$((i / 100))"
+        mkdir -p "$dir"
+        : > "$dir/f$i.c"
+        i=$((i + 1))
+    done
+
+    cd "$project"
+    PATH="$WORK/bin:$PATH" "$CBUILD" > /dev/null 2>&1
+
+    start=$(date +%s.%N)
+    PATH="$WORK/bin:$PATH" "$CBUILD" > /dev/null 2>&1
+    end=$(date +%s.%N)
+
+    echo "$count,$(awk "BEGIN { print $end - $start }")"
+    cd "$WORK"
+    rm -rf "$project"
+done
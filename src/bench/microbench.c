@@ -0,0 +1,282 @@
+/// Author - zebubull
+/// microbench.c
+/// Microbenchmarks for the string, split and timetable helpers.
+/// Copyright (c) zebubull 2023
+///
+/// Built instead of cbuild itself by the `microbench` rule. Prints one CSV
+/// row per benchmark, pass a name to only run benchmarks containing it.
+
+#ifdef CB_MICROBENCH
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "../mem/cbmem.h"
+#include "../os/time.h"
+#include "../os/dir.h"
+#include "../util/cbstr.h"
+#include "../util/cbsplit.h"
+#include "../util/cbtimetable.h"
+
+// Every benchmark is run with more ops until it takes at least this long
+#define MIN_BENCH_NS (200 * 1000 * 1000LL)
+#define MAX_BENCH_OPS ((size_t)1 << 32)
+
+#define GROWTH_RESET 4096
+#define TT_BENCH_ENTRIES 10000
+#define TT_BENCH_PATH ".cbuild/microbench-timetable"
+
+typedef void (*bench_fn_t)(size_t ops);
+
+static int64_t timer_start_ns;
+static size_t timer_start_allocs;
+static size_t timer_start_reallocs;
+
+static int64_t bench_ns;
+static size_t bench_allocs;
+static size_t bench_reallocs;
+
+// Benchmarks call these around the part being measured so setup is left out
+static void timer_start() {
+    cbmem_counters(&timer_start_allocs, &timer_start_reallocs);
+    timer_start_ns = monotonic_ns();
+}
+
+static void timer_stop() {
+    bench_ns = monotonic_ns() - timer_start_ns;
+    cbmem_counters(&bench_allocs, &bench_reallocs);
+    bench_allocs -= timer_start_allocs;
+    bench_reallocs -= timer_start_reallocs;
+}
+
+static void run_bench(const char *name, bench_fn_t fn) {
+    size_t ops = 1;
+
+    for (;;) {
+        double scale;
+
+        fn(ops);
+
+        if (bench_ns >= MIN_BENCH_NS || ops >= MAX_BENCH_OPS) {
+            break;
+        }
+
+        // Aim a bit past the minimum going by the last run, but never grow
+        // more than 100x at once in case the last run was noise
+        scale = bench_ns <= 0 ? 100.0 : (MIN_BENCH_NS * 1.2) / bench_ns;
+        if (scale > 100.0) scale = 100.0;
+        if (scale < 2.0) scale = 2.0;
+        ops = (size_t)(ops * scale);
+    }
+
+    printf("%s,%llu,%.2f,%.4f,%.4f\n", name, (unsigned long long)ops, (double)bench_ns / ops, (double)bench_allocs / ops, (double)bench_reallocs / ops);
+    fflush(stdout);
+}
+
+static void bench_concat_format(size_t ops) {
+    size_t i;
+    cbstr_t rule = cbstr_from_lit("release");
+    cbstr_t name = cbstr_from_lit("cbtimetable.c");
+    cbstr_t str = cbstr_with_cap(64);
+
+    timer_start();
+    for (i = 0; i < ops; ++i) {
+        cbstr_clear(&str);
+        cbstr_concat_format(&str, CB_CSTR("obj/linux/%s/util/%s"), &rule, &name);
+    }
+    timer_stop();
+
+    cbstr_free(&str);
+    cbstr_free(&name);
+    cbstr_free(&rule);
+}
+
+// One op is one append, the string starts over every GROWTH_RESET appends
+// so allocs/op shows the amortized cost of growing
+static void bench_concat_growth(size_t ops) {
+    size_t i;
+    cbstr_t str = cbstr_with_cap(1);
+
+    timer_start();
+    for (i = 0; i < ops; ++i) {
+        if (i % GROWTH_RESET == GROWTH_RESET - 1) {
+            cbstr_free(&str);
+            str = cbstr_with_cap(1);
+        }
+        cbstr_concat_cstr(&str, CB_CSTR("0123456789abcde"));
+    }
+    timer_stop();
+
+    cbstr_free(&str);
+}
+
+static void bench_localize_path(size_t ops) {
+    size_t i;
+    cbstr_t path = cbstr_from_lit("src\\util/cbtimetable\\entries/cbtimetable.c");
+
+    timer_start();
+    for (i = 0; i < ops; ++i) {
+        cbstr_localize_path(&path);
+    }
+    timer_stop();
+
+    cbstr_free(&path);
+}
+
+// One op is one word
+static void bench_split_next(size_t ops) {
+    static const char config[] =
+        "source src\n"
+        "project cbuild\n"
+        "cache on\n\n"
+        "flag -Wall\n"
+        "flag -std=gnu17\n\n"
+        "rule debug\n"
+        "define DEBUG\n"
+        "flag -g\n"
+        "endrule\n\n"
+        "rule release\n"
+        "define RELEASE\n"
+        "flag -O4\n"
+        "endrule\n";
+    char buffer[sizeof(config)];
+    cbsplit_t view;
+    size_t i;
+    size_t words = 0;
+
+    memcpy(buffer, config, sizeof(config));
+    view = cbsplit_init(buffer, sizeof(config) - 1);
+
+    timer_start();
+    for (i = 0; i < ops; ++i) {
+        if (!cbsplit_next(&view)) {
+            view = cbsplit_init(buffer, sizeof(config) - 1);
+            cbsplit_next(&view);
+        }
+        words += view.len;
+    }
+    timer_stop();
+
+    // Keeps the loop from being optimized out
+    if (words == 1) printf("\n");
+}
+
+static void fill_timetable(tt_t *table, cbstr_t *names, cbstr_t *parents) {
+    size_t i;
+    tt_stamp_t stamp = {0, 0, 0};
+    cbstr_list_t deps = cbstr_list_init(1);
+
+    for (i = 0; i < TT_BENCH_ENTRIES; ++i) {
+        cbstr_t object = cbstr_with_cap(32);
+        cbstr_concat_format(&object, CB_CSTR("obj/%s.o"), &names[i]);
+        tt_record(table, &names[i], &parents[i], 0, &object, &stamp, &deps);
+        cbstr_free(&object);
+    }
+
+    cbstr_list_free(&deps);
+}
+
+static void make_names(cbstr_t *names, cbstr_t *parents) {
+    size_t i;
+    char buffer[64];
+
+    for (i = 0; i < TT_BENCH_ENTRIES; ++i) {
+        int len = snprintf(buffer, sizeof(buffer), "file%llu.c", (unsigned long long)i);
+        names[i] = cbstr_from_cstr(buffer, len);
+        len = snprintf(buffer, sizeof(buffer), "src/dir%llu", (unsigned long long)(i / 100));
+        parents[i] = cbstr_from_cstr(buffer, len);
+    }
+}
+
+static void free_names(cbstr_t *names, cbstr_t *parents) {
+    size_t i;
+
+    for (i = 0; i < TT_BENCH_ENTRIES; ++i) {
+        cbstr_free(&names[i]);
+        cbstr_free(&parents[i]);
+    }
+}
+
+static cbstr_t tt_names[TT_BENCH_ENTRIES];
+static cbstr_t tt_parents[TT_BENCH_ENTRIES];
+
+static void bench_tt_search(size_t ops) {
+    size_t i;
+    size_t found = 0;
+    // Walks the entries in a scattered order
+    size_t index = 0;
+    tt_t table = tt_init(TT_BENCH_ENTRIES);
+
+    fill_timetable(&table, tt_names, tt_parents);
+
+    timer_start();
+    for (i = 0; i < ops; ++i) {
+        index = (index + 7919) % TT_BENCH_ENTRIES;
+        found += tt_search(&table, &tt_names[index], &tt_parents[index], 0) != NULL;
+    }
+    timer_stop();
+
+    if (found != ops) {
+        printf("[ERROR] tt_search missed %llu entries\n", (unsigned long long)(ops - found));
+    }
+
+    tt_free(&table);
+}
+
+// One op is a save of a changed table and a load of the file it wrote
+static void bench_tt_roundtrip(size_t ops) {
+    size_t i;
+    tt_t table = tt_init(TT_BENCH_ENTRIES);
+
+    fill_timetable(&table, tt_names, tt_parents);
+
+    timer_start();
+    for (i = 0; i < ops; ++i) {
+        tt_t loaded;
+
+        table.dirty = true;
+        tt_save(&table, TT_BENCH_PATH);
+        tt_load(&loaded, TT_BENCH_PATH);
+        tt_free(&loaded);
+    }
+    timer_stop();
+
+    tt_free(&table);
+}
+
+int main(int argc, char **argv) {
+    static const struct {
+        const char *name;
+        bench_fn_t fn;
+    } benches[] = {
+        {"cbstr_concat_format", bench_concat_format},
+        {"cbstr_concat_cstr_growth", bench_concat_growth},
+        {"cbstr_localize_path", bench_localize_path},
+        {"cbsplit_next", bench_split_next},
+        {"tt_search", bench_tt_search},
+        {"tt_save_load", bench_tt_roundtrip},
+    };
+    size_t i;
+
+    DEBUG_INIT();
+
+    create_dir(".cbuild");
+    make_names(tt_names, tt_parents);
+
+    printf("benchmark,ops,ns_per_op,allocs_per_op,reallocs_per_op\n");
+
+    for (i = 0; i < sizeof(benches) / sizeof(benches[0]); ++i) {
+        if (argc > 1 && strstr(benches[i].name, argv[1]) == NULL) continue;
+        run_bench(benches[i].name, benches[i].fn);
+    }
+
+    free_names(tt_names, tt_parents);
+    remove(TT_BENCH_PATH);
+
+    DEBUG_DEINIT();
+
+    return 0;
+}
+
+#endif /* CB_MICROBENCH */
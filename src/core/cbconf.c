@@ -7,23 +7,214 @@
 #include "../util/cbstr.h"
 #include "../util/cbsplit.h"
 #include "../util/cblog.h"
+#include "../os/proc.h"
 
 #include <stdlib.h>
 
+static size_t parse_count(const char *data, size_t len) {
+    size_t count = 0;
+    size_t i;
+
+    for (i = 0; i < len; ++i) {
+        if (data[i] < '0' || data[i] > '9') {
+            return 0;
+        }
+        count = count * 10 + (data[i] - '0');
+    }
+
+    return count;
+}
+
+static cbstr_list_t copy_list(cbstr_list_t *list) {
+    cbstr_list_t copy = cbstr_list_init(list->len + 4);
+    size_t i;
+
+    for (i = 0; i < list->len; ++i) {
+        cbstr_list_push(&copy, cbstr_copy(cbstr_list_get(list, i)));
+    }
+
+    return copy;
+}
+
+static cbstr_t copy_optional(cbstr_t *str) {
+    cbstr_t copy = {.data = NULL, .len = 0, .capacity = 0};
+
+    if (str->data != NULL) {
+        copy = cbstr_copy(str);
+    }
+
+    return copy;
+}
+
+// Makes `target` a copy of `config` named `name`, without its targets or
+// anything it depends on
+static void copy_conf(cbconf_t *target, cbconf_t *config, cbsplit_t *name) {
+    *target = *config;
+    target->targets = NULL;
+    target->target_count = 0;
+    target->source = copy_optional(&config->source);
+    target->project = cbstr_from_cstr(name->data, name->len);
+    target->defines = copy_list(&config->defines);
+    target->flags = copy_list(&config->flags);
+    target->link_flags = copy_list(&config->link_flags);
+    target->libs = copy_list(&config->libs);
+    target->depends = cbstr_list_init(2);
+    target->pch = copy_optional(&config->pch);
+    target->cc = copy_optional(&config->cc);
+    target->ld = copy_optional(&config->ld);
+    target->linker = copy_optional(&config->linker);
+    target->object_cache_dir = copy_optional(&config->object_cache_dir);
+    target->train = copy_list(&config->train);
+    target->instrumented = copy_optional(&config->instrumented);
+}
+
+// Starts a target block with everything set outside of one so far, the
+// target's name doubles as its project name
+static void target_init(cbconf_t *target, cbconf_t *config, cbsplit_t *name) {
+    size_t i;
+
+    for (i = 0; i < config->target_count - 1; ++i) {
+        cbstr_t *other = &config->targets[i].project;
+
+        if (other->len == name->len + 1 && strncmp(other->data, name->data, name->len) == 0) {
+            eprintf("[ERROR] Multiple definition of a target\n");
+            exit(1);
+        }
+    }
+
+    copy_conf(target, config, name);
+}
+
+// Adds a copy of the target at `index` that is built to collect profiles,
+// which the target depends on and is trained with
+static void add_instrumented(cbconf_t *config, size_t *cap, size_t index) {
+    cbconf_t *target;
+    cbconf_t *instrumented;
+    cbstr_t name;
+    cbsplit_t view;
+
+    if (config->targets[index].type != TARGET_EXECUTABLE) {
+        eprintf("[ERROR] Target '%s' can't use pgo, only executables can.\n", config->targets[index].project.data);
+        exit(1);
+    }
+
+    name = cbstr_copy(&config->targets[index].project);
+    cbstr_concat_cstr(&name, CB_CSTR("-instrumented"));
+    view = cbsplit_init(name.data, name.len - 1);
+    view.len = name.len - 1;
+
+    if (config->target_count == *cap) {
+        *cap = *cap == 0 ? 4 : *cap << 1;
+        config->targets = REALLOC(config->targets, *cap * sizeof(cbconf_t));
+    }
+
+    target = &config->targets[index];
+    instrumented = &config->targets[config->target_count++];
+    copy_conf(instrumented, target, &view);
+    cbstr_list_free(&instrumented->depends);
+    instrumented->depends = copy_list(&target->depends);
+    instrumented->pgo = PGO_GENERATE;
+
+    cbstr_list_push(&target->depends, cbstr_copy(&name));
+    target->instrumented = name;
+
+    // Profiles are kept per object, and unity batches are only made on
+    // full rebuilds
+    target->unity = false;
+    instrumented->unity = false;
+}
+
 cbconf_t cbconf_init(char *buffer, size_t len, int argc, char **argv) {
     cbstr_t rule;
     cbsplit_t view;
     cbconf_t config;
     config.cache = false;
+    config.unity = false;
+    config.unity_batch = 16;
+    config.partial_link = false;
+    config.object_cache = false;
+    config.object_cache_dir.data = NULL;
+    config.object_cache_dir.len = 0;
+    config.object_cache_dir.capacity = 0;
+    config.object_cache_size = 2048;
+    config.jobs = 0;
+    config.walk_threads = 1;
+    config.watch = false;
+    config.trace = NULL;
     config.defines = cbstr_list_init(4);
     config.flags = cbstr_list_init(4);
+    config.link_flags = cbstr_list_init(4);
+    config.debuginfo = DEBUG_INFO_NONE;
+    config.package_dwo = false;
+    config.lto = LTO_OFF;
+    config.pgo = PGO_OFF;
+    config.train = cbstr_list_init(4);
+    config.instrumented.data = NULL;
+    config.instrumented.len = 0;
+    config.instrumented.capacity = 0;
+    config.type = TARGET_EXECUTABLE;
+    config.libs = cbstr_list_init(4);
+    config.pch.data = NULL;
+    config.pch.len = 0;
+    config.pch.capacity = 0;
+    config.cc = config.pch;
+    config.ld = config.pch;
+    config.linker = config.pch;
+    config.source.data = NULL;
+    config.source.len = 0;
+    config.source.capacity = 0;
+    config.project.data = NULL;
+    config.project.len = 0;
+    config.project.capacity = 0;
+    config.depends = cbstr_list_init(2);
+    config.targets = NULL;
+    config.target_count = 0;
+    // Directives outside of a target block go here
+    cbconf_t *conf = &config;
+    size_t target_cap = 0;
     bool has_source = false;
     bool has_proj = false;
+    bool has_rule = false;
     bool ignore_rule = false;
+    size_t arg_jobs = 0;
+    size_t declared;
+    int i;
+
+    for (i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--watch") == 0) {
+            config.watch = true;
+        } else if (strcmp(argv[i], "--trace") == 0) {
+            if (++i == argc) {
+                eprintf("[ERROR] Expected a file after '--trace'.\n");
+                exit(1);
+            }
+            config.trace = argv[i];
+        } else if (strncmp(argv[i], "-j", 2) == 0) {
+            const char *count = argv[i] + 2;
+
+            if (*count == 0) {
+                if (++i == argc) {
+                    eprintf("[ERROR] Expected a job count after '-j'.\n");
+                    exit(1);
+                }
+                count = argv[i];
+            }
+
+            arg_jobs = parse_count(count, strnlen(count, 16));
 
-    if (argc > 1) {
-        rule = cbstr_from_cstr(argv[1], strnlen(argv[1], 64));
-    } else {
+            if (arg_jobs == 0) {
+                eprintf("[ERROR] Invalid job count '%s'.\n", count);
+                exit(1);
+            }
+        } else if (!has_rule) {
+            rule = cbstr_from_cstr(argv[i], strnlen(argv[i], 64));
+            has_rule = true;
+        } else {
+            eprintf("[WARNING] Ignoring extra argument '%s'\n", argv[i]);
+        }
+    }
+
+    if (!has_rule) {
         rule = cbstr_from_cstr("default", sizeof("default"));
     }
 
@@ -56,6 +247,36 @@ cbconf_t cbconf_init(char *buffer, size_t len, int argc, char **argv) {
             continue;
         }
 
+        if (strncmp("target", view.data, view.len) == 0) {
+            if (!cbsplit_next(&view)) {
+                eprintf("[ERROR] Unexpected EOS in cbuild conf.\n");
+                exit(1);
+            }
+
+            if (conf != &config) {
+                eprintf("[ERROR] Target blocks can't be nested.\n");
+                exit(1);
+            }
+
+            if (config.target_count == target_cap) {
+                target_cap = target_cap == 0 ? 4 : target_cap << 1;
+                config.targets = REALLOC(config.targets, target_cap * sizeof(cbconf_t));
+            }
+
+            conf = &config.targets[config.target_count++];
+            target_init(conf, &config, &view);
+            has_source = false;
+            has_proj = false;
+            continue;
+        }
+
+        if (strncmp("endtarget", view.data, view.len) == 0) {
+            conf = &config;
+            has_source = config.source.data != NULL;
+            has_proj = config.project.data != NULL;
+            continue;
+        }
+
         if (strncmp("source", view.data, view.len) == 0) {
             if (!has_source) {
                 if (!cbsplit_next(&view)) {
@@ -63,7 +284,9 @@ cbconf_t cbconf_init(char *buffer, size_t len, int argc, char **argv) {
                     exit(1);
                 }
 
-                config.source = cbstr_from_cstr(view.data, view.len);
+                // Targets start out with the source set outside of them
+                cbstr_free(&conf->source);
+                conf->source = cbstr_from_cstr(view.data, view.len);
                 has_source = true;
             } else {
                 eprintf("[ERROR] Multiple definition of source\n");
@@ -76,7 +299,8 @@ cbconf_t cbconf_init(char *buffer, size_t len, int argc, char **argv) {
                     exit(1);
                 }
 
-                config.project = cbstr_from_cstr(view.data, view.len);
+                cbstr_free(&conf->project);
+                conf->project = cbstr_from_cstr(view.data, view.len);
                 has_proj = true;
             } else {
                 eprintf("[ERROR] Multiple definition of project\n");
@@ -96,20 +320,259 @@ cbconf_t cbconf_init(char *buffer, size_t len, int argc, char **argv) {
                 eprintf("[ERROR] Unknown cache mode in cbuild conf.\n");
                 exit(1);
             }
+        } else if (strncmp("unity", view.data, view.len) == 0) {
+            if (!cbsplit_next(&view)) {
+                eprintf("[ERROR] Unexpected EOS in cbuild conf.\n");
+                exit(1);
+            }
+
+            if (strncmp("on", view.data, view.len) == 0) {
+                conf->unity = true;
+            } else if (strncmp("off", view.data, view.len) == 0) {
+                conf->unity = false;
+            } else {
+                eprintf("[ERROR] Unknown unity mode in cbuild conf.\n");
+                exit(1);
+            }
+        } else if (strncmp("unity_batch", view.data, view.len) == 0) {
+            if (!cbsplit_next(&view)) {
+                eprintf("[ERROR] Unexpected EOS in cbuild conf.\n");
+                exit(1);
+            }
+
+            conf->unity_batch = parse_count(view.data, view.len);
+
+            if (conf->unity_batch == 0) {
+                eprintf("[ERROR] Invalid unity batch size in cbuild conf.\n");
+                exit(1);
+            }
+        } else if (strncmp("partial_link", view.data, view.len) == 0) {
+            if (!cbsplit_next(&view)) {
+                eprintf("[ERROR] Unexpected EOS in cbuild conf.\n");
+                exit(1);
+            }
+
+            if (strncmp("on", view.data, view.len) == 0) {
+                conf->partial_link = true;
+            } else if (strncmp("off", view.data, view.len) == 0) {
+                conf->partial_link = false;
+            } else {
+                eprintf("[ERROR] Unknown partial link mode in cbuild conf.\n");
+                exit(1);
+            }
+        } else if (strncmp("object_cache", view.data, view.len) == 0) {
+            if (!cbsplit_next(&view)) {
+                eprintf("[ERROR] Unexpected EOS in cbuild conf.\n");
+                exit(1);
+            }
+
+            if (strncmp("on", view.data, view.len) == 0) {
+                config.object_cache = true;
+            } else if (strncmp("off", view.data, view.len) == 0) {
+                config.object_cache = false;
+            } else {
+                eprintf("[ERROR] Unknown object cache mode in cbuild conf.\n");
+                exit(1);
+            }
+        } else if (strncmp("object_cache_dir", view.data, view.len) == 0) {
+            if (!cbsplit_next(&view)) {
+                eprintf("[ERROR] Unexpected EOS in cbuild conf.\n");
+                exit(1);
+            }
+
+            cbstr_free(&config.object_cache_dir);
+            config.object_cache_dir = cbstr_from_cstr(view.data, view.len);
+        } else if (strncmp("object_cache_size", view.data, view.len) == 0) {
+            if (!cbsplit_next(&view)) {
+                eprintf("[ERROR] Unexpected EOS in cbuild conf.\n");
+                exit(1);
+            }
+
+            config.object_cache_size = parse_count(view.data, view.len);
+
+            if (config.object_cache_size == 0) {
+                eprintf("[ERROR] Invalid object cache size in cbuild conf.\n");
+                exit(1);
+            }
         } else if (strncmp("define", view.data, view.len) == 0) {
             if (!cbsplit_next(&view)) {
                 eprintf("[ERROR] Unexpected EOS in cbuild conf.\n");
                 exit(1);
             }
 
-            cbstr_list_push(&config.defines, cbstr_from_cstr(view.data, view.len));
+            cbstr_list_push(&conf->defines, cbstr_from_cstr(view.data, view.len));
         } else if (strncmp("flag", view.data, view.len) == 0) {
             if (!cbsplit_next(&view)) {
                 eprintf("[ERROR] Unexpected EOS in cbuild conf.\n");
                 exit(1);
             }
 
-            cbstr_list_push(&config.flags, cbstr_from_cstr(view.data, view.len));
+            cbstr_list_push(&conf->flags, cbstr_from_cstr(view.data, view.len));
+        } else if (strncmp("link_flag", view.data, view.len) == 0) {
+            if (!cbsplit_next(&view)) {
+                eprintf("[ERROR] Unexpected EOS in cbuild conf.\n");
+                exit(1);
+            }
+
+            cbstr_list_push(&conf->link_flags, cbstr_from_cstr(view.data, view.len));
+        } else if (strncmp("debuginfo", view.data, view.len) == 0) {
+            if (!cbsplit_next(&view)) {
+                eprintf("[ERROR] Unexpected EOS in cbuild conf.\n");
+                exit(1);
+            }
+
+            if (strncmp("none", view.data, view.len) == 0) {
+                conf->debuginfo = DEBUG_INFO_NONE;
+            } else if (strncmp("full", view.data, view.len) == 0) {
+                conf->debuginfo = DEBUG_INFO_FULL;
+            } else if (strncmp("split", view.data, view.len) == 0) {
+                conf->debuginfo = DEBUG_INFO_SPLIT;
+            } else {
+                eprintf("[ERROR] Unknown debug info mode in cbuild conf.\n");
+                exit(1);
+            }
+        } else if (strncmp("lto", view.data, view.len) == 0) {
+            if (!cbsplit_next(&view)) {
+                eprintf("[ERROR] Unexpected EOS in cbuild conf.\n");
+                exit(1);
+            }
+
+            if (strncmp("off", view.data, view.len) == 0) {
+                conf->lto = LTO_OFF;
+            } else if (strncmp("thin", view.data, view.len) == 0) {
+                conf->lto = LTO_THIN;
+            } else if (strncmp("full", view.data, view.len) == 0) {
+                conf->lto = LTO_FULL;
+            } else {
+                eprintf("[ERROR] Unknown lto mode in cbuild conf.\n");
+                exit(1);
+            }
+        } else if (strncmp("pgo", view.data, view.len) == 0) {
+            if (!cbsplit_next(&view)) {
+                eprintf("[ERROR] Unexpected EOS in cbuild conf.\n");
+                exit(1);
+            }
+
+            if (strncmp("on", view.data, view.len) == 0) {
+                conf->pgo = PGO_USE;
+            } else if (strncmp("off", view.data, view.len) == 0) {
+                conf->pgo = PGO_OFF;
+            } else {
+                eprintf("[ERROR] Unknown pgo mode in cbuild conf.\n");
+                exit(1);
+            }
+        } else if (strncmp("train", view.data, view.len) == 0) {
+            if (!cbsplit_next(&view)) {
+                eprintf("[ERROR] Unexpected EOS in cbuild conf.\n");
+                exit(1);
+            }
+
+            cbstr_list_push(&conf->train, cbstr_from_cstr(view.data, view.len));
+        } else if (strncmp("package_dwo", view.data, view.len) == 0) {
+            if (!cbsplit_next(&view)) {
+                eprintf("[ERROR] Unexpected EOS in cbuild conf.\n");
+                exit(1);
+            }
+
+            if (strncmp("on", view.data, view.len) == 0) {
+                conf->package_dwo = true;
+            } else if (strncmp("off", view.data, view.len) == 0) {
+                conf->package_dwo = false;
+            } else {
+                eprintf("[ERROR] Unknown dwo packaging mode in cbuild conf.\n");
+                exit(1);
+            }
+        } else if (strncmp("type", view.data, view.len) == 0) {
+            if (!cbsplit_next(&view)) {
+                eprintf("[ERROR] Unexpected EOS in cbuild conf.\n");
+                exit(1);
+            }
+
+            if (strncmp("executable", view.data, view.len) == 0) {
+                conf->type = TARGET_EXECUTABLE;
+            } else if (strncmp("static", view.data, view.len) == 0) {
+                conf->type = TARGET_STATIC;
+            } else if (strncmp("shared", view.data, view.len) == 0) {
+                conf->type = TARGET_SHARED;
+            } else {
+                eprintf("[ERROR] Unknown target type in cbuild conf.\n");
+                exit(1);
+            }
+        } else if (strncmp("lib", view.data, view.len) == 0) {
+            if (!cbsplit_next(&view)) {
+                eprintf("[ERROR] Unexpected EOS in cbuild conf.\n");
+                exit(1);
+            }
+
+            cbstr_list_push(&conf->libs, cbstr_from_cstr(view.data, view.len));
+        } else if (strncmp("depends", view.data, view.len) == 0) {
+            if (!cbsplit_next(&view)) {
+                eprintf("[ERROR] Unexpected EOS in cbuild conf.\n");
+                exit(1);
+            }
+
+            cbstr_list_push(&conf->depends, cbstr_from_cstr(view.data, view.len));
+        } else if (strncmp("pch", view.data, view.len) == 0) {
+            if (conf->pch.data == NULL) {
+                if (!cbsplit_next(&view)) {
+                    eprintf("[ERROR] Unexpected EOS in cbuild conf.\n");
+                    exit(1);
+                }
+
+                conf->pch = cbstr_from_cstr(view.data, view.len);
+            } else {
+                eprintf("[ERROR] Multiple definition of pch\n");
+                exit(1);
+            }
+        } else if (strncmp("cc", view.data, view.len) == 0) {
+            if (!cbsplit_next(&view)) {
+                eprintf("[ERROR] Unexpected EOS in cbuild conf.\n");
+                exit(1);
+            }
+
+            // Targets can swap out the one set before them
+            cbstr_free(&conf->cc);
+            conf->cc = cbstr_from_cstr(view.data, view.len);
+        } else if (strncmp("ld", view.data, view.len) == 0) {
+            if (!cbsplit_next(&view)) {
+                eprintf("[ERROR] Unexpected EOS in cbuild conf.\n");
+                exit(1);
+            }
+
+            cbstr_free(&conf->ld);
+            conf->ld = cbstr_from_cstr(view.data, view.len);
+        } else if (strncmp("linker", view.data, view.len) == 0) {
+            if (!cbsplit_next(&view)) {
+                eprintf("[ERROR] Unexpected EOS in cbuild conf.\n");
+                exit(1);
+            }
+
+            cbstr_free(&conf->linker);
+            conf->linker = cbstr_from_cstr(view.data, view.len);
+        } else if (strncmp("jobs", view.data, view.len) == 0) {
+            if (!cbsplit_next(&view)) {
+                eprintf("[ERROR] Unexpected EOS in cbuild conf.\n");
+                exit(1);
+            }
+
+            config.jobs = parse_count(view.data, view.len);
+
+            if (config.jobs == 0) {
+                eprintf("[ERROR] Invalid job count in cbuild conf.\n");
+                exit(1);
+            }
+        } else if (strncmp("walk_threads", view.data, view.len) == 0) {
+            if (!cbsplit_next(&view)) {
+                eprintf("[ERROR] Unexpected EOS in cbuild conf.\n");
+                exit(1);
+            }
+
+            config.walk_threads = parse_count(view.data, view.len);
+
+            if (config.walk_threads == 0) {
+                eprintf("[ERROR] Invalid walk thread count in cbuild conf.\n");
+                exit(1);
+            }
         } else {
             char cache = view.data[view.len];
             view.data[view.len] = 0;
@@ -118,19 +581,77 @@ cbconf_t cbconf_init(char *buffer, size_t len, int argc, char **argv) {
         }
     }
 
-    if (!has_proj || !has_source) {
+    if (conf != &config) {
+        eprintf("[ERROR] Expected 'endtarget' before the end of the cbuild conf.\n");
+        exit(1);
+    }
+
+    if (config.target_count == 0 && (config.project.data == NULL || config.source.data == NULL)) {
         eprintf("[ERROR] not enough information specified in cbuild...\n");
         exit(1);
     }
 
+    // Made into a target of its own so it can depend on the instrumented one
+    if (config.target_count == 0 && config.pgo == PGO_USE) {
+        view = cbsplit_init(config.project.data, config.project.len - 1);
+        view.len = config.project.len - 1;
+
+        target_cap = 4;
+        config.targets = MALLOC(target_cap * sizeof(cbconf_t));
+        config.target_count = 1;
+        target_init(&config.targets[0], &config, &view);
+        cbstr_list_free(&config.targets[0].depends);
+        config.targets[0].depends = copy_list(&config.depends);
+    }
+
+    // Only the targets from the config, not the copies added on the way
+    for (i = 0, declared = config.target_count; i < (int)declared; ++i) {
+        if (config.targets[i].pgo == PGO_USE) {
+            add_instrumented(&config, &target_cap, i);
+        }
+    }
+
+    for (i = 0; i < (int)config.target_count; ++i) {
+        if (config.targets[i].source.data == NULL) {
+            eprintf("[ERROR] No source specified for target '%s'.\n", config.targets[i].project.data);
+            exit(1);
+        }
+
+        config.targets[i].rule = cbstr_copy(&rule);
+    }
+
+    // The command line always wins over the config file
+    if (arg_jobs != 0) {
+        config.jobs = arg_jobs;
+    } else if (config.jobs == 0) {
+        config.jobs = proc_cpu_count();
+    }
+
     config.rule = rule;
     return config;
 }
 
 void cbconf_free(cbconf_t *conf) {
+    size_t i;
+
+    for (i = 0; i < conf->target_count; ++i) {
+        cbconf_free(&conf->targets[i]);
+    }
+    FREE(conf->targets);
+
     cbstr_free(&conf->source);
     cbstr_free(&conf->project);
     cbstr_free(&conf->rule);
     cbstr_list_free(&conf->defines);
     cbstr_list_free(&conf->flags);
+    cbstr_list_free(&conf->link_flags);
+    cbstr_list_free(&conf->libs);
+    cbstr_list_free(&conf->depends);
+    cbstr_free(&conf->pch);
+    cbstr_free(&conf->cc);
+    cbstr_free(&conf->ld);
+    cbstr_free(&conf->linker);
+    cbstr_list_free(&conf->train);
+    cbstr_free(&conf->instrumented);
+    cbstr_free(&conf->object_cache_dir);
 }
@@ -6,13 +6,94 @@
 
 #include "../util/cbstr.h"
 
+typedef enum target_type {
+    TARGET_EXECUTABLE,
+    TARGET_STATIC,
+    TARGET_SHARED,
+} target_type_t;
+
+typedef enum debug_info {
+    DEBUG_INFO_NONE,
+    DEBUG_INFO_FULL,
+    // Debug info goes into a .dwo next to each object and the linker only
+    // sees what is needed to find it
+    DEBUG_INFO_SPLIT,
+} debug_info_t;
+
+typedef enum lto_mode {
+    LTO_OFF,
+    // Optimized in partitions side by side, ThinLTO with clang
+    LTO_THIN,
+    // Optimized as one whole program
+    LTO_FULL,
+} lto_mode_t;
+
+typedef enum pgo_mode {
+    PGO_OFF,
+    // Built from the profiles of its instrumented copy
+    PGO_USE,
+    // The instrumented copy, built to collect profiles
+    PGO_GENERATE,
+} pgo_mode_t;
+
 typedef struct cbconf {
     cbstr_t source;
     cbstr_t project;
     cbstr_t rule;
     cbstr_list_t defines;
     cbstr_list_t flags;
+    // Passed to the link but not to the compiler
+    cbstr_list_t link_flags;
+    debug_info_t debuginfo;
+    // Package the .dwo files of a split debug info link into one .dwp
+    bool package_dwo;
+    lto_mode_t lto;
+    pgo_mode_t pgo;
+    // Arguments the instrumented executable is trained with
+    cbstr_list_t train;
+    // Name of the instrumented target with PGO_USE, data is NULL otherwise
+    cbstr_t instrumented;
+    target_type_t type;
+    // Libraries to link the output against
+    cbstr_list_t libs;
+    // Names of the targets that have to be built first, the libraries among
+    // them are linked against
+    cbstr_list_t depends;
+    // Header to precompile for every translation unit, data is NULL if unset
+    cbstr_t pch;
+    // The compiler and the program to link with, which is the compiler
+    // unless set. data is NULL for the defaults.
+    cbstr_t cc;
+    cbstr_t ld;
+    // Linker the link driver is told to use with -fuse-ld, data is NULL for
+    // its default
+    cbstr_t linker;
+    size_t jobs;
+    // Threads used to walk the source directory
+    size_t walk_threads;
     bool cache;
+    // Compile full rebuilds as unity batches of up to unity_batch files
+    bool unity;
+    size_t unity_batch;
+    // Link the objects of each source directory into one relocatable object
+    // first, so a change only relinks its own directory and the groups
+    bool partial_link;
+    // Share objects between rules and checkouts through a cache directory,
+    // object_cache_dir data is NULL for the default one
+    bool object_cache;
+    cbstr_t object_cache_dir;
+    // In megabytes
+    size_t object_cache_size;
+    // Keep running and rebuild whenever a source file changes
+    bool watch;
+    // Where to write a chrome trace of the build, NULL if not tracing.
+    // Points into argv.
+    const char *trace;
+
+    // Each target block is a config of its own, starting out with whatever
+    // was set before it. A config without any is its own only target.
+    struct cbconf *targets;
+    size_t target_count;
 } cbconf_t;
 
 cbconf_t cbconf_init(char *buffer, size_t len, int argc, char **argv);
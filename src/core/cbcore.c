@@ -2,201 +2,2024 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "cbcore.h"
 #include "cbconf.h"
+#include "cbjob.h"
 #include "../os/dir.h"
+#include "../os/watch.h"
 #include "../os/osdef.h"
 #include "../mem/cbmem.h"
 #include "../util/cbtimetable.h"
 #include "../util/cbstr.h"
+#include "../util/cbdep.h"
+#include "../util/cbhash.h"
+#include "../util/cbcache.h"
+#include "../util/cbelf.h"
+#include "../util/cbtoolchain.h"
 #include "../util/cblog.h"
+#include "../util/cbtrace.h"
+#include "../os/time.h"
 
 #ifdef _WIN32
 // I haven't written wrappers for deleting and moving files so some win32 api is still needed
 #include <Windows.h>
 #endif /* _WIN32 */
 
-#define COMMAND_SIZE 1024 * 4
+#define COMPILE_ARENA_BLOCK (16 * 1024)
+
+// Runs `call` as a span on the main track of the trace
+#define TRACE_PHASE(name, call) do {\
+    int64_t phase_start = monotonic_ns();\
+    call;\
+    cbtrace_phase(name, phase_start, monotonic_ns());\
+} while (0)
+
+// How long the tree has to be quiet before watch mode rebuilds
+#define WATCH_DEBOUNCE_MS 100
 
 static tt_t timetable;
+// Set in watch mode once the first build is done, objects are only written
+// by cbuild itself from then on so they aren't checked every rebuild
+static bool trust_objects = false;
+
+typedef enum file_state {
+    FILE_BUILD,
+    FILE_UP_TO_DATE,
+    // Up to date, but built into a unity object shared with other files
+    FILE_IN_BATCH,
+} file_state_t;
+
+// A file that has to be compiled, or will be if the unity batch it was
+// built in can't be reused
+typedef struct pending_file {
+    dir_entry_t *file;
+    cbstr_t path;
+    cbstr_t object;
+    // The unity object the file was last built into, len is 0 if there is none
+    cbstr_t batch;
+    bool build;
+} pending_file_t;
+
+typedef struct pending_list {
+    pending_file_t *files;
+    size_t len;
+    size_t cap;
+} pending_list_t;
+
+// The files built by one compiler run, more than one for a unity batch
+typedef struct compile_unit {
+    dir_entry_t **files;
+    size_t count;
+    cbstr_t source;
+    cbstr_t object;
+    cbstr_t depfile;
+    // Object cache key, 0 until the source is preprocessed and hashed
+    uint64_t key;
+    bool preprocessed;
+} compile_unit_t;
+
+// Where compile jobs go and everything they are made from
+typedef struct compile_queue {
+    cbjob_pool_t *pool;
+    cbstr_list_t *stub;
+    cbarena_t *arena;
+    cbstr_list_t *objects;
+    // NULL if the object cache is off
+    cbcache_t *cache;
+    // Hash of `stub`, objects are kept in a directory named after it
+    uint64_t command;
+    char command_hex[17];
+    // Units that haven't finished yet
+    size_t running;
+    // Index of the target the jobs belong to, handed back as the job tag
+    size_t target;
+    // Identifies the compiler binary for the object cache
+    uint64_t compiler;
+} compile_queue_t;
+
+typedef enum stage {
+    // Waiting on the targets it depends on
+    STAGE_WAITING,
+    // Running the instrumented copy to collect profiles
+    STAGE_TRAIN,
+    STAGE_PCH,
+    // Waiting on another target building the same pch
+    STAGE_PCH_SHARED,
+    STAGE_COMPILE,
+    // Waiting on another target compiling the same objects
+    STAGE_COMPILE_SHARED,
+    // Linking the objects of each directory into a group object
+    STAGE_PARTIAL,
+    // Waiting on another target linking the same group objects
+    STAGE_PARTIAL_SHARED,
+    STAGE_LINK,
+    STAGE_DONE,
+    STAGE_FAILED,
+} stage_t;
+
+// The objects of one source directory, linked into one relocatable object
+typedef struct link_group {
+    cbstr_t output;
+    // Views of the target's objects
+    cbstr_list_t objects;
+    uint64_t command;
+} link_group_t;
+
+// Everything one target needs while it builds. Targets build side by side on
+// one job pool, and each one moves on as its own jobs finish.
+typedef struct target {
+    cbconf_t *conf;
+    dir_t *files;
+    stage_t stage;
+    cbtoolchain_t toolchain;
+    // Targets it depends on that aren't done yet
+    size_t waiting;
+    // The target building the pch or objects this one shares with it
+    struct target *sharing;
+    // Whether anything was compiled
+    bool built;
+    // Everything made per file lives in here, except for the scratch
+    // strings below which are reused for every file
+    cbarena_t arena;
+    cbstr_list_t stub;
+    cbstr_list_t objects;
+    compile_queue_t queue;
+    cbstr_t path;
+    cbstr_t object;
+    cbstr_t prefix;
+    cbstr_t gch;
+    // What the pch is recorded with once it's built
+    uint64_t pch_command;
+    tt_stamp_t pch_stamp;
+    cbstr_t output;
+    cbstr_t temp;
+    // What the output is recorded with once it's linked
+    uint64_t link_command;
+    cbstr_list_t inputs;
+    // Archive members to add once the deleted ones are gone
+    cbstr_list_t replaced;
+    // Whether the .dwo files are being packaged after the link
+    bool packaging;
+    // The target trained with, with PGO_USE
+    struct target *instrumented;
+    // Whether it was trained this build, its profiles are only linked next
+    // to this target's objects then
+    bool trained;
+    uint64_t train_command;
+    // Scratch space for linking profiles
+    cbstr_t profile;
+    cbstr_t gcda;
+    // Only used with partial linking. The final link is made from `linked`,
+    // the group objects and the objects that had a directory to themselves.
+    link_group_t *groups;
+    size_t group_count;
+    size_t group_running;
+    cbstr_list_t linked;
+} target_t;
+
+typedef struct build {
+    cbjob_pool_t pool;
+    target_t *targets;
+    size_t count;
+    // NULL if the object cache is off
+    cbcache_t *cache;
+} build_t;
+
+static void scan_target(build_t *build, target_t *target);
+static void compile_target(build_t *build, target_t *target);
+static void link_target(build_t *build, target_t *target);
+static void finish_target(build_t *build, target_t *target, bool ok);
+
+// Targets with the same source directory, flags and compiler build the same
+// pch, objects and group objects into the same place, so only the first one
+// to get there builds them and the others wait for it. Returns true and parks
+// the target if another one is already building the output of `command` in
+// `stage`.
+static bool share_build(build_t *build, target_t *target, stage_t stage, uint64_t command) {
+    size_t i;
+
+    for (i = 0; i < build->count; ++i) {
+        target_t *other = &build->targets[i];
+
+        if (other == target || other->stage != stage) continue;
+        if ((stage == STAGE_PCH ? other->pch_command : other->queue.command) != command) continue;
+
+        printf("[INFO] %s waits for %s, which builds the same files\n", target->conf->project.data, other->conf->project.data);
+        target->sharing = other;
+        // Every shared stage comes right after the one it waits on
+        target->stage = stage + 1;
+        return true;
+    }
+
+    return false;
+}
+
+// Picks up every target that waited on `target`, the timetable has whatever
+// it built by now so they find it up to date
+static void resume_shared(build_t *build, target_t *target, bool ok) {
+    size_t i;
+
+    for (i = 0; i < build->count; ++i) {
+        target_t *other = &build->targets[i];
+
+        if (other->sharing != target) continue;
+
+        other->sharing = NULL;
+
+        if (!ok) {
+            finish_target(build, other, false);
+        } else if (other->stage == STAGE_PCH_SHARED) {
+            compile_target(build, other);
+        } else if (other->stage == STAGE_COMPILE_SHARED) {
+            scan_target(build, other);
+        } else {
+            link_target(build, other);
+        }
+    }
+}
+
+file_state_t file_state(cbstr_t *object, cbstr_t *path, dir_entry_t *file, cbstr_t *parent, uint64_t command, tt_entry_t **entry) {
+    cbstr_t obj_file;
+
+    // A file built with other flags isn't found at all
+    *entry = tt_search(&timetable, &file->filename, parent, command);
+
+    if (!(*entry)) {
+        return FILE_BUILD;
+    }
+
+    if (tt_entry_source_changed(&timetable, *entry, path->data, file->write_time, file->size)) {
+        return FILE_BUILD;
+    }
+
+    if (tt_entry_deps_changed(&timetable, *entry)) {
+        return FILE_BUILD;
+    }
+
+    obj_file = tt_string(&timetable, (*entry)->obj_file);
+
+    if (!cbstr_cmp(&obj_file, object)) {
+        return FILE_IN_BATCH;
+    }
+
+    return trust_objects || file_exists(object->data) ? FILE_UP_TO_DATE : FILE_BUILD;
+}
+
+static uint64_t hash_command(cbstr_list_t *command) {
+    uint64_t hash = CBHASH_SEED;
+    size_t i;
+
+    for (i = 0; i < command->len; ++i) {
+        cbstr_t *arg = cbstr_list_get(command, i);
+        hash = cbhash_bytes(arg->data, arg->len, hash);
+    }
+
+    return hash;
+}
+
+static const char *compiler(cbconf_t *conf) {
+    return conf->cc.data != NULL ? conf->cc.data : "gcc";
+}
+
+static const char *link_driver(cbconf_t *conf) {
+    return conf->ld.data != NULL ? conf->ld.data : compiler(conf);
+}
+
+// Built once and shared by every compile job
+void set_compiler_stub(cbconf_t *conf, cbtoolchain_t *toolchain, cbstr_list_t *stub) {
+    const char *cc = compiler(conf);
+    size_t i;
+
+    cbstr_list_push(stub, cbstr_from_cstr(cc, strlen(cc) + 1));
+    cbstr_list_push(stub, cbstr_from_lit("-c"));
+    cbstr_list_push(stub, cbstr_from_lit("-MMD"));
+
+    // Before the flags so a -g level given there still wins
+    if (conf->debuginfo != DEBUG_INFO_NONE) {
+        cbstr_list_push(stub, cbstr_from_lit("-g"));
+    }
+
+    if (conf->debuginfo == DEBUG_INFO_SPLIT) {
+        cbstr_list_push(stub, cbstr_from_lit("-gsplit-dwarf"));
+
+        // dwp can't read split DWARF 5 yet
+        if (conf->package_dwo) {
+            cbstr_list_push(stub, cbstr_from_lit("-gdwarf-4"));
+        }
+    }
+
+    // gcc only decides how to partition the program at link time
+    if (conf->lto != LTO_OFF && !toolchain->clang) {
+        cbstr_list_push(stub, cbstr_from_lit("-flto"));
+    } else if (conf->lto == LTO_THIN) {
+        cbstr_list_push(stub, cbstr_from_lit("-flto=thin"));
+    } else if (conf->lto == LTO_FULL) {
+        cbstr_list_push(stub, cbstr_from_lit("-flto=full"));
+    }
+
+    if (conf->pgo == PGO_GENERATE) {
+        cbstr_list_push(stub, cbstr_from_lit("-fprofile-generate"));
+    } else if (conf->pgo == PGO_USE) {
+        cbstr_list_push(stub, cbstr_from_lit("-fprofile-use"));
+    }
+
+    for (i = 0; i < conf->defines.len; ++i) {
+        cbstr_t define = cbstr_with_cap(16);
+        cbstr_concat_format(&define, CB_CSTR("-D%s"), cbstr_list_get(&conf->defines, i));
+        cbstr_list_push(stub, define);
+    }
+
+    for (i = 0; i < conf->flags.len; ++i) {
+        cbstr_list_push(stub, cbstr_copy(cbstr_list_get(&conf->flags, i)));
+    }
+
+    #ifdef UNIX
+    if (conf->type == TARGET_SHARED) {
+        cbstr_list_push(stub, cbstr_from_lit("-fPIC"));
+    }
+    #endif /* UNIX */
+}
+
+// Reads the headers listed in a dependency file, the first prerequisite is
+// the file that was compiled so it is left out
+static void load_deps(cbstr_t *depfile, cbstr_list_t *deps) {
+    if (cbdep_load(depfile->data, deps) && deps->len != 0) {
+        cbstr_free(&deps->strings[0]);
+        deps->strings[0] = deps->strings[deps->len - 1];
+        --deps->len;
+    } else {
+        eprintf("[WARNING] Could not read '%s', header changes will not be tracked.\n", depfile->data);
+    }
+}
+
+// Sets `path` to the profile gcc uses for `object`
+static void gcda_path(cbstr_t *object, cbstr_t *path) {
+    cbstr_clear(path);
+    // Without the o and the terminator
+    cbstr_concat_cstr(path, object->data, object->len - 2);
+    cbstr_concat_cstr(path, CB_CSTR("gcda"));
+}
+
+// Records every file of a unit as built into its object by `command`. `pch`
+// is the precompiled header the unit was built with, or NULL. With `profile`
+// the unit was built from the .gcda next to its object, which is recorded as
+// a dependency when it exists.
+static void record_unit(dir_t *files, compile_unit_t *unit, uint64_t command, cbstr_t *pch, bool profile) {
+    tt_stamp_t stamp;
+    cbstr_list_t deps;
+    cbstr_t gcda;
+    size_t i;
+
+    deps = cbstr_list_init(8);
+
+    load_deps(&unit->depfile, &deps);
+
+    // A unity source lists every file in the batch, which aren't headers.
+    // Each file gets every header of the batch, which is never too few.
+    if (unit->count > 1) {
+        for (i = deps.len; i > 0; --i) {
+            cbstr_t *dep = &deps.strings[i-1];
+
+            if (dep->len > 2 && dep->data[dep->len-2] == 'c' && dep->data[dep->len-3] == '.') {
+                cbstr_free(dep);
+                deps.strings[i-1] = deps.strings[deps.len - 1];
+                --deps.len;
+            }
+        }
+    }
+
+    // The headers inside the pch don't show up in the dependency file, so
+    // the object depends on the pch itself instead
+    if (pch != NULL) {
+        cbstr_list_push(&deps, cbstr_copy(pch));
+    }
+
+    // Built from the profile next to the object, so only a change to the
+    // profile of this file rebuilds it
+    if (profile) {
+        gcda = cbstr_with_cap(unit->object.len + 3);
+        gcda_path(&unit->object, &gcda);
+
+        if (file_exists(gcda.data)) {
+            cbstr_list_push(&deps, gcda);
+        } else {
+            cbstr_free(&gcda);
+        }
+    }
+
+    for (i = 0; i < unit->count; ++i) {
+        dir_entry_t *file = unit->files[i];
+        cbstr_t *parent = cbstr_list_get(&files->dir_names, file->parent);
+
+        stamp.write_time = file->write_time;
+        stamp.size = file->size;
+        stamp.hash = file->hash;
+        tt_record(&timetable, &file->filename, parent, command, &unit->object, &stamp, &deps);
+    }
+
+    cbstr_list_free(&deps);
+}
+
+// Writes an include of `path` into a file `depth` directories below the
+// project root
+static void write_include(FILE *file, cbstr_t *path, size_t depth) {
+    size_t i;
+
+    fprintf(file, "#include \"");
+
+    if (path->data[0] != '/' && path->data[0] != '\\' && (path->len < 3 || path->data[1] != ':')) {
+        for (i = 0; i < depth; ++i) {
+            fprintf(file, "../");
+        }
+    }
+
+    fprintf(file, "%s\"\n", path->data);
+}
+
+// Writes the header that compiles get pointed at with -include. gcc loads
+// the .gch next to it instead, and only falls back to the real header
+// through it if the .gch can't be used.
+static bool write_pch_include(cbstr_t *include, cbstr_t *header, size_t depth) {
+    FILE *file = fopen(include->data, "wb");
+
+    if (!file) {
+        return false;
+    }
+
+    write_include(file, header, depth);
+    fclose(file);
+
+    return true;
+}
+
+// The pch is recorded under its file name and directory like a source is
+static void pch_key(cbstr_t *header, cbstr_t *name, cbstr_t *parent) {
+    size_t i;
+    size_t slash = 0;
+
+    for (i = 0; i < header->len; ++i) {
+        if (header->data[i] == '/' || header->data[i] == '\\') {
+            slash = i + 1;
+        }
+    }
+
+    *name = cbstr_from_cstr(header->data + slash, header->len - slash);
+    if (slash > 1) {
+        *parent = cbstr_from_cstr(header->data, slash - 1);
+    } else {
+        *parent = cbstr_from_lit(".");
+    }
+}
+
+// Points every compile at the pch, through the header next to the .gch
+static void use_pch(target_t *target) {
+    cbstr_t include = cbstr_copy(&target->gch);
+
+    // Drop the .gch
+    include.len -= 4;
+    include.data[include.len - 1] = 0;
+
+    cbstr_list_push(&target->stub, cbstr_from_lit("-include"));
+    cbstr_list_push(&target->stub, include);
+}
+
+// Queues a precompile of the `pch` header into .cbuild if it, anything it
+// includes or the flags it is compiled with changed, and moves the target to
+// STAGE_PCH if it did. `gch` is set to the precompiled header. Returns false
+// if it could not be built.
+static bool start_pch(build_t *build, target_t *target) {
+    cbconf_t *conf = target->conf;
+    char hash_hex[17];
+    int64_t write_time;
+    uint64_t size;
+    tt_entry_t *entry;
+    cbstr_t name;
+    cbstr_t parent;
+    cbstr_t include;
+    cbstr_list_t args;
+    size_t depth = 0;
+    size_t i;
+    bool up_to_date;
+
+    // Kept under the hash of its flags like objects are, so rules with the
+    // same flags share it
+    target->pch_command = cbhash_bytes(&target->toolchain.compiler, sizeof(uint64_t), hash_command(&target->stub));
+    snprintf(hash_hex, sizeof(hash_hex), "%016llx", (unsigned long long)target->pch_command);
+
+    if (share_build(build, target, STAGE_PCH, target->pch_command)) {
+        return true;
+    }
+
+    pch_key(&conf->pch, &name, &parent);
+
+    include = cbstr_with_cap(64);
+    cbstr_concat_cstr(&include, CB_CSTR(".cbuild/pch/"));
+    cbstr_concat_cstr(&include, hash_hex, 16);
+    cbstr_localize_path(&include);
+    create_dir(include.data);
+    cbstr_concat_format(&include, CB_CSTR("/%s"), &name);
+    cbstr_localize_path(&include);
+
+    cbstr_clear(&target->gch);
+    cbstr_concat(&target->gch, &include);
+    cbstr_concat_cstr(&target->gch, CB_CSTR(".gch"));
+
+    if (!file_stat(conf->pch.data, &write_time, &size)) {
+        eprintf("[ERROR] Could not find precompiled header '%s'!\n", conf->pch.data);
+        cbstr_free(&include);
+        cbstr_free(&parent);
+        cbstr_free(&name);
+        return false;
+    }
+
+    entry = tt_search(&timetable, &name, &parent, target->pch_command);
+    up_to_date = entry != NULL
+        && !tt_entry_source_changed(&timetable, entry, conf->pch.data, write_time, size)
+        && !tt_entry_deps_changed(&timetable, entry)
+        && file_exists(target->gch.data);
+
+    cbstr_free(&parent);
+    cbstr_free(&name);
+
+    if (up_to_date) {
+        printf("[INFO] %s up to date\n", target->gch.data);
+        use_pch(target);
+        cbstr_free(&include);
+        return true;
+    }
+
+    target->pch_stamp.write_time = write_time;
+    target->pch_stamp.size = size;
+    if (!cbhash_file(conf->pch.data, &target->pch_stamp.hash)) {
+        target->pch_stamp.hash = 0;
+    }
+
+    for (i = 0; i < include.len; ++i) {
+        if (include.data[i] == '/' || include.data[i] == '\\') {
+            ++depth;
+        }
+    }
+
+    if (!write_pch_include(&include, &conf->pch, depth)) {
+        eprintf("[ERROR] Could not write '%s'!\n", include.data);
+        cbstr_free(&include);
+        return false;
+    }
+
+    args = cbstr_list_init(7);
+    cbstr_list_push(&args, CB_VIEW("-x"));
+    cbstr_list_push(&args, CB_VIEW("c-header"));
+    cbstr_list_push(&args, cbstr_copy(&conf->pch));
+    cbstr_list_push(&args, CB_VIEW("-o"));
+    cbstr_list_push(&args, cbstr_copy(&target->gch));
+    cbstr_list_push(&args, CB_VIEW("-MF"));
+    cbstr_list_push(&args, include);
+    cbstr_concat_cstr(&args.strings[6], CB_CSTR(".d"));
+
+    target->stage = STAGE_PCH;
+    cbjob_push(&build->pool, &target->stub, args, NULL, target->queue.target);
+    return true;
+}
+
+// Records the pch once it's built and starts on the sources
+static void finish_pch(build_t *build, target_t *target, int code) {
+    cbstr_t name;
+    cbstr_t parent;
+    cbstr_t depfile;
+    cbstr_list_t deps;
+
+    if (code != 0) {
+        finish_target(build, target, false);
+        resume_shared(build, target, false);
+        return;
+    }
+
+    pch_key(&target->conf->pch, &name, &parent);
+
+    depfile = cbstr_copy(&target->gch);
+    // Swap the .gch for .d
+    depfile.len -= 2;
+    depfile.data[depfile.len - 2] = 'd';
+    depfile.data[depfile.len - 1] = 0;
+
+    deps = cbstr_list_init(8);
+    load_deps(&depfile, &deps);
+    tt_record(&timetable, &name, &parent, target->pch_command, &target->gch, &target->pch_stamp, &deps);
+    cbstr_list_free(&deps);
+
+    cbstr_free(&depfile);
+    cbstr_free(&parent);
+    cbstr_free(&name);
+
+    use_pch(target);
+    scan_target(build, target);
+    resume_shared(build, target, true);
+}
+
+static void pending_push(pending_list_t *list, pending_file_t item) {
+    if (list->len == list->cap) {
+        list->cap <<= 1;
+        list->files = REALLOC(list->files, list->cap * sizeof(pending_file_t));
+    }
+
+    list->files[list->len] = item;
+    ++list->len;
+}
+
+static void create_parent_dir(cbstr_t *path) {
+    size_t i;
+    char end;
+
+    for (i = path->len - 1; i > 0; --i) {
+        if (path->data[i] == '/' || path->data[i] == '\\') {
+            break;
+        }
+    }
+
+    if (i == 0) {
+        return;
+    }
+
+    end = path->data[i];
+    path->data[i] = 0;
+    create_dir(path->data);
+    path->data[i] = end;
+}
+
+// Unity objects are named unity<index>-<count>.o after how many files went
+// into them
+static size_t batch_count(cbstr_t *batch) {
+    size_t i;
+    size_t dash = 0;
+    size_t count = 0;
+
+    for (i = 0; i < batch->len; ++i) {
+        if (batch->data[i] == '-') {
+            dash = i + 1;
+        }
+    }
+
+    for (i = dash; dash != 0 && batch->data[i] >= '0' && batch->data[i] <= '9'; ++i) {
+        count = count * 10 + (batch->data[i] - '0');
+    }
+
+    return count;
+}
+
+static int compare_batch(const void *a, const void *b) {
+    const pending_file_t *x = a;
+    const pending_file_t *y = b;
+
+    if (x->batch.len == 0 || y->batch.len == 0) {
+        return (x->batch.len != 0) - (y->batch.len != 0);
+    }
+
+    return strcmp(x->batch.data, y->batch.data);
+}
+
+// Groups files by directory, in name order so batches come out the same
+// every time
+static int compare_dir(const void *a, const void *b) {
+    const pending_file_t *x = a;
+    const pending_file_t *y = b;
+
+    if (x->file->parent != y->file->parent) {
+        return x->file->parent < y->file->parent ? -1 : 1;
+    }
+
+    return strcmp(x->file->filename.data, y->file->filename.data);
+}
+
+// Links a unity object again if every file in it is up to date and still
+// there, the files of any other batch are compiled on their own instead.
+// Reused files are taken out of `pending`.
+static void reuse_batches(pending_list_t *pending, cbstr_list_t *objects) {
+    size_t i;
+    size_t j;
+    size_t end;
+    size_t kept = 0;
+
+    qsort(pending->files, pending->len, sizeof(pending_file_t), compare_batch);
+
+    for (i = 0; i < pending->len; i = end) {
+        cbstr_t batch = pending->files[i].batch;
+        bool intact = true;
+
+        if (batch.len == 0) {
+            pending->files[kept++] = pending->files[i];
+            end = i + 1;
+            continue;
+        }
+
+        for (end = i; end < pending->len && cbstr_cmp(&pending->files[end].batch, &batch); ++end) {
+            intact = intact && !pending->files[end].build;
+        }
+
+        intact = intact && end - i == batch_count(&batch) && (trust_objects || file_exists(batch.data));
+
+        if (intact) {
+            for (j = i; j < end; ++j) {
+                printf("[INFO] %s up to date\n", pending->files[j].path.data);
+            }
+
+            cbstr_list_push(objects, batch);
+            continue;
+        }
+
+        for (j = i; j < end; ++j) {
+            pending->files[j].build = true;
+            pending->files[kept++] = pending->files[j];
+        }
+    }
+
+    pending->len = kept;
+}
+
+static compile_unit_t *unit_init(compile_queue_t *queue, size_t count) {
+    compile_unit_t *unit = cbarena_alloc(queue->arena, sizeof(compile_unit_t) + count * sizeof(dir_entry_t*));
+
+    ++queue->running;
+
+    unit->files = (dir_entry_t**)(unit + 1);
+    unit->count = count;
+    unit->key = 0;
+    unit->preprocessed = false;
+
+    return unit;
+}
+
+// Queues the next step of building a unit. With the object cache on, the
+// source is preprocessed first so it can be looked up before compiling.
+static void push_unit(compile_queue_t *queue, compile_unit_t *unit) {
+    cbstr_list_t args = cbstr_list_init(6);
+
+    cbstr_list_push(&args, unit->source);
+
+    if (queue->cache != NULL && !unit->preprocessed) {
+        cbstr_t preprocessed = cbstr_arena_copy(queue->arena, &unit->object);
+        preprocessed.data[preprocessed.len-2] = 'i';
+
+        cbstr_list_push(&args, CB_VIEW("-E"));
+        cbstr_list_push(&args, CB_VIEW("-o"));
+        cbstr_list_push(&args, preprocessed);
+    } else {
+        // Objects can be hard links into the object cache, which the
+        // compiler would otherwise write straight through
+        remove(unit->object.data);
+
+        cbstr_list_push(&args, CB_VIEW("-o"));
+        cbstr_list_push(&args, unit->object);
+    }
+
+    // Preprocessing writes the same dependency file compiling does
+    cbstr_list_push(&args, CB_VIEW("-MF"));
+    cbstr_list_push(&args, unit->depfile);
+
+    cbjob_push(queue->pool, queue->stub, args, unit, queue->target);
+}
+
+// Looks a preprocessed unit up in the object cache, its object is in place
+// if it was found
+static bool fetch_unit(compile_queue_t *queue, compile_unit_t *unit, cbstr_t *preprocessed) {
+    bool found = false;
+
+    cbstr_clear(preprocessed);
+    cbstr_concat(preprocessed, &unit->object);
+    preprocessed->data[preprocessed->len-2] = 'i';
+
+    if (cbcache_key(queue->compiler, queue->stub, preprocessed->data, &unit->key)) {
+        found = cbcache_fetch(queue->cache, unit->key, unit->object.data);
+    } else {
+        unit->key = 0;
+    }
+
+    remove(preprocessed->data);
+    return found;
+}
+
+// Queues a compile of one file into its own object
+static void push_file(compile_queue_t *queue, pending_file_t *item) {
+    compile_unit_t *unit = unit_init(queue, 1);
+
+    // Only directories that get an object written to them are made
+    create_parent_dir(&item->object);
+
+    // Hashed before compiling so an edit made during the build isn't recorded as built
+    if (!cbhash_file(item->path.data, &item->file->hash)) {
+        item->file->hash = 0;
+    }
+
+    unit->files[0] = item->file;
+    unit->source = item->path;
+    unit->object = item->object;
+    // Swap the object extension for the dependency file one
+    unit->depfile = cbstr_arena_copy(queue->arena, &item->object);
+    unit->depfile.data[unit->depfile.len-2] = 'd';
+
+    cbstr_list_push(queue->objects, unit->object);
+    push_unit(queue, unit);
+}
+
+// Queues a compile of `count` files as one source that includes all of them.
+// `base` is the path of the unity source without its extension.
+static void push_unity(compile_queue_t *queue, pending_file_t *items, size_t count, cbstr_t *base) {
+    compile_unit_t *unit;
+    FILE *file;
+    size_t depth = 0;
+    size_t i;
+
+    create_parent_dir(base);
+
+    for (i = 0; i < base->len; ++i) {
+        if (base->data[i] == '/' || base->data[i] == '\\') {
+            ++depth;
+        }
+    }
+
+    cbstr_concat_cstr(base, CB_CSTR(".c"));
+    file = fopen(base->data, "wb");
+
+    if (!file) {
+        eprintf("[WARNING] Could not write '%s', compiling its files one at a time.\n", base->data);
+
+        for (i = 0; i < count; ++i) {
+            push_file(queue, &items[i]);
+        }
+        return;
+    }
+
+    unit = unit_init(queue, count);
+    unit->source = cbstr_arena_copy(queue->arena, base);
+    unit->object = cbstr_arena_copy(queue->arena, base);
+    unit->object.data[unit->object.len-2] = 'o';
+    unit->depfile = cbstr_arena_copy(queue->arena, base);
+    unit->depfile.data[unit->depfile.len-2] = 'd';
+
+    for (i = 0; i < count; ++i) {
+        write_include(file, &items[i].path, depth);
+        unit->files[i] = items[i].file;
+
+        if (!cbhash_file(items[i].path.data, &items[i].file->hash)) {
+            items[i].file->hash = 0;
+        }
+    }
+
+    fclose(file);
+
+    cbstr_list_push(queue->objects, unit->object);
+    push_unit(queue, unit);
+}
+
+// Queues the files of a full rebuild as unity batches of at most
+// `unity_batch` files from the same directory
+static void push_unity_batches(cbconf_t *conf, dir_t *files, compile_queue_t *queue, pending_list_t *pending, cbstr_t *base) {
+    size_t i;
+    size_t end;
+
+    qsort(pending->files, pending->len, sizeof(pending_file_t), compare_dir);
+
+    for (i = 0; i < pending->len; i = end) {
+        size_t dir = pending->files[i].file->parent;
+        cbstr_t *parent = cbstr_list_get(&files->dir_names, dir);
+        size_t batches;
+        size_t batch;
+        size_t first = i;
+
+        for (end = i; end < pending->len && pending->files[end].file->parent == dir; ++end);
+
+        // Spread evenly so there is no tiny batch left over at the end
+        batches = (end - i + conf->unity_batch - 1) / conf->unity_batch;
+
+        for (batch = 0; batch < batches; ++batch) {
+            size_t count = (end - first) / (batches - batch);
+            char name[48];
+            int len;
+
+            if (count == 1) {
+                push_file(queue, &pending->files[first]);
+                ++first;
+                continue;
+            }
+
+            len = snprintf(name, sizeof(name), "unity%llu-%llu", (unsigned long long)batch, (unsigned long long)count);
+
+            cbstr_clear(base);
+            cbstr_concat_cstr(base, CB_CSTR(".cbuild/unity/"));
+            cbstr_concat_cstr(base, queue->command_hex, 16);
+            cbstr_concat_cstr(base, CB_CSTR("/"));
+            cbstr_concat_slice(base, parent, conf->source.len);
+            if (parent->len != conf->source.len) {
+                cbstr_concat_cstr(base, CB_CSTR("/"));
+            }
+            cbstr_concat_cstr(base, name, len);
+            cbstr_localize_path(base);
+
+            push_unity(queue, &pending->files[first], count, base);
+            first += count;
+        }
+    }
+}
+
+static int compare_str(const void *a, const void *b) {
+    return strcmp(((const cbstr_t*)a)->data, ((const cbstr_t*)b)->data);
+}
+
+// Whether `output` is still what `command` linked, from objects that haven't
+// changed since
+static bool output_up_to_date(cbstr_t *output, uint64_t command) {
+    cbstr_t parent = CB_VIEW(".");
+    int64_t write_time;
+    uint64_t size;
+    tt_entry_t *entry = tt_search(&timetable, output, &parent, command);
+
+    return entry != NULL
+        && file_stat(output->data, &write_time, &size)
+        && !tt_entry_source_changed(&timetable, entry, output->data, write_time, size)
+        && !tt_entry_deps_changed(&timetable, entry);
+}
+
+// Records a successful link, the objects are tracked the way headers are for
+// a source file
+static void record_output(cbstr_t *output, uint64_t command, cbstr_list_t *objects) {
+    cbstr_t parent = CB_VIEW(".");
+    tt_stamp_t stamp;
+
+    if (!file_stat(output->data, &stamp.write_time, &stamp.size) || !cbhash_file(output->data, &stamp.hash)) {
+        return;
+    }
+
+    tt_record(&timetable, output, &parent, command, output, &stamp, objects);
+}
+
+// Sets `output` to the file the rule builds
+static void output_name(cbconf_t *conf, cbstr_t *output) {
+    switch (conf->type) {
+    case TARGET_STATIC:
+        #ifdef _WIN32
+        cbstr_concat_format(output, CB_CSTR("%s-%s.lib"), &conf->project, &conf->rule);
+        #endif /* _WIN32 */
+        #ifdef UNIX
+        cbstr_concat_format(output, CB_CSTR("lib%s-%s.a"), &conf->project, &conf->rule);
+        #endif /* UNIX */
+        break;
+    case TARGET_SHARED:
+        #ifdef _WIN32
+        cbstr_concat_format(output, CB_CSTR("%s-%s.dll"), &conf->project, &conf->rule);
+        #endif /* _WIN32 */
+        #ifdef __linux__
+        cbstr_concat_format(output, CB_CSTR("lib%s-%s.so"), &conf->project, &conf->rule);
+        #endif /* __linux__ */
+        #ifdef __APPLE__
+        cbstr_concat_format(output, CB_CSTR("lib%s-%s.dylib"), &conf->project, &conf->rule);
+        #endif /* __APPLE__ */
+        break;
+    default:
+        #ifdef _WIN32
+        cbstr_concat_format(output, CB_CSTR("%s-%s.exe"), &conf->project, &conf->rule);
+        #endif /* _WIN32 */
+        #ifdef UNIX
+        cbstr_concat_format(output, CB_CSTR("%s-%s.out"), &conf->project, &conf->rule);
+        #endif /* UNIX */
+        break;
+    }
+}
+
+// Sets `path` to the file holding the interface hash of a shared library
+static void interface_path(cbstr_t *library, cbstr_t *path) {
+    cbstr_clear(path);
+    cbstr_concat(path, library);
+    cbstr_concat_cstr(path, CB_CSTR(".ifc"));
+}
+
+// Writes the interface hash of a shared library next to it. Anything linked
+// against the library depends on that file instead, so it is only relinked
+// when the interface changes. Without a hash it depends on the library itself.
+static void write_interface(cbstr_t *library) {
+    cbstr_t path = cbstr_with_cap(library->len + 4);
+    uint64_t hash;
+    FILE *file;
+
+    interface_path(library, &path);
+
+    if (!cbelf_interface_hash(library->data, &hash)) {
+        remove(path.data);
+        cbstr_free(&path);
+        return;
+    }
+
+    file = fopen(path.data, "wb");
+
+    if (file == NULL) {
+        eprintf("[WARNING] Could not write '%s', everything linked against %s will be relinked.\n", path.data, library->data);
+        remove(path.data);
+    } else {
+        fprintf(file, "%016llx\n", (unsigned long long)hash);
+        fclose(file);
+    }
+
+    cbstr_free(&path);
+}
+
+static void close_cache(cbcache_t *cache) {
+    if (cache != NULL) {
+        cbcache_close(cache);
+    }
+}
+
+// Starts a link command with the link driver and the linker it should use
+static void push_link_driver(target_t *target, cbstr_list_t *args) {
+    cbconf_t *conf = target->conf;
+    const char *ld = link_driver(conf);
+
+    cbstr_list_push(args, cbstr_from_cstr(ld, strlen(ld) + 1));
+
+    if (conf->linker.data != NULL && target->toolchain.fuse_ld) {
+        cbstr_t fuse_ld = cbstr_with_cap(conf->linker.len + 9);
+        cbstr_concat_format(&fuse_ld, CB_CSTR("-fuse-ld=%s"), &conf->linker);
+        cbstr_list_push(args, fuse_ld);
+    }
+}
+
+// Adds the LTO mode to a link
+static void push_lto(target_t *target, cbstr_list_t *args) {
+    cbconf_t *conf = target->conf;
+
+    if (conf->lto == LTO_OFF) return;
+
+    if (target->toolchain.clang) {
+        cbstr_list_push(args, conf->lto == LTO_THIN ? CB_VIEW("-flto=thin") : CB_VIEW("-flto=full"));
+    } else {
+        cbstr_list_push(args, conf->lto == LTO_THIN ? CB_VIEW("-flto-partition=balanced") : CB_VIEW("-flto-partition=one"));
+    }
+}
+
+// Adds how many jobs the LTO link runs at once. It is left out of the link
+// command hash, so changing the job count doesn't relink.
+static void push_lto_jobs(build_t *build, target_t *target, cbstr_list_t *args) {
+    cbconf_t *conf = target->conf;
+    cbstr_t jobs;
+
+    if (conf->lto == LTO_OFF) return;
+
+    // Full LTO optimizes the whole program as one, only gcc can still
+    // compile the result in parallel
+    if (target->toolchain.clang && conf->lto == LTO_FULL) return;
+
+    jobs = cbstr_with_cap(24);
+    jobs.len = snprintf(jobs.data, jobs.capacity, target->toolchain.clang ? "-flto-jobs=%llu" : "-flto=%llu", (unsigned long long)build->pool.workers) + 1;
+    cbstr_list_push(args, jobs);
+}
+
+// Queues the link of an executable or shared library from `objects`, unless
+// nothing it is linked from changed. Returns false if there was nothing to do.
+static bool start_link(build_t *build, target_t *target, cbstr_list_t *objects) {
+    cbconf_t *conf = target->conf;
+    size_t i;
+    cbstr_list_t args;
+
+    args = cbstr_list_init(objects->len + conf->libs.len + conf->link_flags.len + 10);
+    target->inputs = cbstr_list_init(objects->len + conf->libs.len + 1);
+    push_link_driver(target, &args);
+    if (conf->type == TARGET_SHARED) {
+        cbstr_list_push(&args, CB_VIEW("-shared"));
+    }
+
+    // Only makes a difference when code is generated at link time
+    if (conf->debuginfo != DEBUG_INFO_NONE) {
+        cbstr_list_push(&args, CB_VIEW("-g"));
+    }
+
+    if (conf->debuginfo == DEBUG_INFO_SPLIT) {
+        cbstr_list_push(&args, CB_VIEW("-gsplit-dwarf"));
+    }
+
+    push_lto(target, &args);
+
+    // The instrumented copy needs gcov, and LTO uses the profiles again
+    if (conf->pgo == PGO_GENERATE) {
+        cbstr_list_push(&args, CB_VIEW("-fprofile-generate"));
+    } else if (conf->pgo == PGO_USE) {
+        cbstr_list_push(&args, CB_VIEW("-fprofile-use"));
+    }
+
+    for (i = 0; i < conf->link_flags.len; ++i) {
+        cbstr_list_push(&args, cbstr_copy(cbstr_list_get(&conf->link_flags, i)));
+    }
+
+    cbstr_list_push(&args, CB_VIEW("-o"));
+    cbstr_list_push(&args, cbstr_copy(&target->output));
+
+    // The objects and groups all live in the arena, so these only borrow them
+    for (i = 0; i < objects->len; ++i) {
+        cbstr_list_push(&args, objects->strings[i]);
+        cbstr_list_push(&target->inputs, objects->strings[i]);
+    }
+
+    for (i = 0; i < conf->libs.len; ++i) {
+        cbstr_t *library = cbstr_list_get(&conf->libs, i);
+        cbstr_t interface = cbstr_with_cap(library->len + 4);
+
+        cbstr_list_push(&args, cbstr_copy(library));
+
+        interface_path(library, &interface);
+        if (file_exists(interface.data)) {
+            cbstr_list_push(&target->inputs, interface);
+        } else {
+            cbstr_free(&interface);
+            cbstr_list_push(&target->inputs, cbstr_copy(library));
+        }
+    }
+
+    target->link_command = hash_command(&args);
+
+    if (!target->built && output_up_to_date(&target->output, target->link_command)) {
+        printf("[INFO] %s up to date\n", target->output.data);
+        cbstr_list_free(&args);
+        return false;
+    }
+
+    push_lto_jobs(build, target, &args);
+
+    // Cache only does stuff on windows
+    #ifdef _WIN32
+    if (conf->cache && conf->type == TARGET_EXECUTABLE) {
+        printf("[INFO] Relocating executable to cache...\n");
+        DeleteFileA(target->temp.data);
+        MoveFileA(target->output.data, target->temp.data);
+    }
+    #endif /* _WIN32 */
+
+    cbjob_push(&build->pool, NULL, args, NULL, target->queue.target);
+    return true;
+}
+
+// Sets `dir` to a view of the directory the object was built from, relative
+// to the source directory and with the trailing separator. Objects live under
+// the target's prefix or, for unity batches, under `unity`.
+static void object_dir(target_t *target, cbstr_t *unity, cbstr_t *object, cbstr_t *dir) {
+    size_t i;
+    size_t start = 0;
+    size_t end;
+
+    if (strncmp(object->data, target->prefix.data, target->prefix.len - 1) == 0) {
+        start = target->prefix.len - 1;
+    } else if (strncmp(object->data, unity->data, unity->len - 1) == 0) {
+        start = unity->len - 1;
+    }
+
+    end = start;
+    for (i = start; i < object->len; ++i) {
+        if (object->data[i] == '/' || object->data[i] == '\\') {
+            end = i + 1;
+        }
+    }
+
+    dir->data = object->data + start;
+    dir->len = end - start;
+    dir->capacity = 0;
+}
+
+static bool same_dir(cbstr_t *a, cbstr_t *b) {
+    return a->len == b->len && strncmp(a->data, b->data, a->len) == 0;
+}
+
+static int compare_object_dir(const void *a, const void *b) {
+    const cbstr_t *x = a;
+    const cbstr_t *y = b;
+    int cmp;
+
+    // Sorted by directory first, the directory is stored after each object
+    cmp = strncmp(x[1].data, y[1].data, x[1].len < y[1].len ? x[1].len : y[1].len);
+    if (cmp == 0 && x[1].len != y[1].len) {
+        cmp = x[1].len < y[1].len ? -1 : 1;
+    }
+
+    return cmp != 0 ? cmp : strcmp(x->data, y->data);
+}
+
+// Queues the partial link of every directory group that changed, the final
+// link starts once they are done. Returns false if there was nothing to do.
+static bool start_groups(build_t *build, target_t *target) {
+    cbstr_list_t *objects = &target->objects;
+    // Each object followed by its directory
+    cbstr_t *items = MALLOC(objects->len * 2 * sizeof(cbstr_t));
+    cbstr_t unity = cbstr_with_cap(48);
+    size_t i;
+    size_t end;
+
+    cbstr_concat_cstr(&unity, CB_CSTR(".cbuild/unity/"));
+    cbstr_concat_cstr(&unity, target->queue.command_hex, 16);
+    cbstr_concat_cstr(&unity, CB_CSTR("/"));
+    cbstr_localize_path(&unity);
+
+    for (i = 0; i < objects->len; ++i) {
+        items[i * 2] = objects->strings[i];
+        object_dir(target, &unity, &objects->strings[i], &items[i * 2 + 1]);
+    }
+
+    cbstr_free(&unity);
+
+    qsort(items, objects->len, 2 * sizeof(cbstr_t), compare_object_dir);
+
+    target->groups = MALLOC((objects->len + 1) * sizeof(link_group_t));
+    target->group_count = 0;
+    target->group_running = 0;
+    target->linked = cbstr_list_init(16);
+
+    for (i = 0; i < objects->len; i = end) {
+        cbstr_t *dir = &items[i * 2 + 1];
+        link_group_t *group;
+        cbstr_list_t args;
+        size_t j;
+
+        for (end = i + 1; end < objects->len && same_dir(&items[end * 2 + 1], dir); ++end);
+
+        // Nothing to gain from linking one object on its own
+        if (end - i == 1) {
+            cbstr_list_push(&target->linked, items[i * 2]);
+            continue;
+        }
+
+        group = &target->groups[target->group_count++];
+        group->objects = cbstr_list_init(end - i);
+
+        cbstr_clear(&target->path);
+        cbstr_concat(&target->path, &target->prefix);
+        cbstr_concat_cstr(&target->path, dir->data, dir->len);
+        cbstr_concat_cstr(&target->path, CB_CSTR("partial.ro"));
+        group->output = cbstr_arena_copy(&target->arena, &target->path);
+        cbstr_list_push(&target->linked, group->output);
+
+        args = cbstr_list_init(end - i + 6);
+        push_link_driver(target, &args);
+        cbstr_list_push(&args, CB_VIEW("-r"));
+        cbstr_list_push(&args, CB_VIEW("-nostdlib"));
+        cbstr_list_push(&args, CB_VIEW("-o"));
+        cbstr_list_push(&args, group->output);
+
+        for (j = i; j < end; ++j) {
+            cbstr_list_push(&args, items[j * 2]);
+            cbstr_list_push(&group->objects, items[j * 2]);
+        }
+
+        group->command = hash_command(&args);
+
+        if (output_up_to_date(&group->output, group->command)) {
+            cbstr_list_free(&args);
+            continue;
+        }
+
+        create_parent_dir(&group->output);
+        cbjob_push(&build->pool, NULL, args, group, target->queue.target);
+        ++target->group_running;
+    }
+
+    FREE(items);
+
+    // Sorted so the same groups always make the same command
+    qsort(target->linked.strings, target->linked.len, sizeof(cbstr_t), compare_str);
+
+    return target->group_running != 0;
+}
+
+// Moves on from a finished partial link, the final link starts after the last
+static void finish_group(build_t *build, target_t *target, cbjob_t *job, proc_status_t *status) {
+    link_group_t *group = job->data;
+
+    cbtrace_job("partial link", group->output.data, job->start, job->end, job->slot, status->code);
+
+    if (status->code == 0) {
+        record_output(&group->output, group->command, &group->objects);
+    } else {
+        target->stage = STAGE_FAILED;
+    }
+
+    if (--target->group_running != 0) return;
+
+    if (target->stage == STAGE_FAILED || build->pool.failed) {
+        finish_target(build, target, false);
+        resume_shared(build, target, false);
+        return;
+    }
+
+    target->stage = STAGE_LINK;
+    if (!start_link(build, target, &target->linked)) {
+        finish_target(build, target, true);
+    }
+
+    resume_shared(build, target, true);
+}
+
+// Archive members are stored by file name alone, so each object is linked
+// into .cbuild/ar under a name that can't collide with another directory's
+static void member_path(cbstr_t *object, cbstr_t *member) {
+    size_t i;
+    size_t slash = 0;
+    char suffix[16];
+    int len;
+
+    for (i = 0; i < object->len; ++i) {
+        if (object->data[i] == '/' || object->data[i] == '\\') {
+            slash = i + 1;
+        }
+    }
+
+    len = snprintf(suffix, sizeof(suffix), ".%08x.o", (uint32_t)cbhash_bytes(object->data, object->len, CBHASH_SEED));
+
+    cbstr_clear(member);
+    cbstr_concat_cstr(member, CB_CSTR(".cbuild/ar/"));
+    cbstr_localize_path(member);
+    // Without the .o and the terminator
+    cbstr_concat_cstr(member, object->data + slash, object->len - slash - 3);
+    cbstr_concat_cstr(member, suffix, len);
+}
+
+// Queues an ar command over `members`, which are handed over to it
+static void push_ar(build_t *build, target_t *target, const char *mode, cbstr_list_t *members) {
+    size_t i;
+    cbstr_list_t args;
+
+    args = cbstr_list_init(members->len + 3);
+    cbstr_list_push(&args, CB_VIEW("ar"));
+    cbstr_list_push(&args, cbstr_from_cstr(mode, strlen(mode) + 1));
+    cbstr_list_push(&args, cbstr_copy(&target->output));
+
+    for (i = 0; i < members->len; ++i) {
+        cbstr_list_push(&args, members->strings[i]);
+    }
+    members->len = 0;
+
+    cbjob_push(&build->pool, NULL, args, NULL, target->queue.target);
+}
+
+// Updates a static library in place. Only the objects that changed since it
+// was last archived are replaced and the ones that are gone are deleted, it
+// is only written from scratch if it is missing or was changed by something
+// else. Returns false if there was nothing to do.
+static bool start_archive(build_t *build, target_t *target) {
+    cbstr_list_t *objects = &target->objects;
+    cbstr_t *output = &target->output;
+    size_t i;
+    uint32_t j;
+    cbstr_t parent = CB_VIEW(".");
+    cbstr_t member = cbstr_with_cap(64);
+    cbstr_list_t deleted = cbstr_list_init(4);
+    bool *kept;
+    int64_t write_time;
+    uint64_t size;
+    tt_entry_t *entry;
+    bool queued = true;
+
+    target->link_command = cbhash_bytes(output->data, output->len, cbhash_bytes(CB_CSTR("ar"), CBHASH_SEED));
+    target->replaced = cbstr_list_init(16);
+
+    kept = MALLOC(objects->len + 1);
+    memset(kept, 0, objects->len + 1);
+
+    entry = tt_search(&timetable, output, &parent, target->link_command);
+
+    if (entry == NULL || !file_stat(output->data, &write_time, &size)
+        || tt_entry_source_changed(&timetable, entry, output->data, write_time, size)) {
+        remove(output->data);
+    } else {
+        for (j = 0; j < entry->dep_count; ++j) {
+            cbstr_t old;
+            bool changed = tt_entry_dep_changed(&timetable, entry, j, &old);
+            cbstr_t *found = bsearch(&old, objects->strings, objects->len, sizeof(cbstr_t), compare_str);
+
+            if (found == NULL) {
+                member_path(&old, &member);
+                cbstr_list_push(&deleted, cbstr_copy(&member));
+            } else {
+                kept[found - objects->strings] = !changed;
+            }
+        }
+    }
+
+    create_dir(".cbuild/ar");
+
+    for (i = 0; i < objects->len; ++i) {
+        if (kept[i]) continue;
+
+        member_path(&objects->strings[i], &member);
+        file_link(objects->strings[i].data, member.data);
+        cbstr_list_push(&target->replaced, cbstr_copy(&member));
+    }
+
+    // s keeps the symbol index up to date. The new members are added once
+    // the deleted ones are gone.
+    if (deleted.len != 0) {
+        push_ar(build, target, "ds", &deleted);
+    } else if (target->replaced.len != 0) {
+        push_ar(build, target, "rcs", &target->replaced);
+    } else {
+        printf("[INFO] %s up to date\n", output->data);
+        queued = false;
+    }
+
+    FREE(kept);
+    cbstr_list_free(&deleted);
+    cbstr_free(&member);
+    return queued;
+}
+
+// Queues packaging the .dwo files the output was linked from into one .dwp
+// next to it, which debuggers find on their own
+static void start_package(build_t *build, target_t *target) {
+    cbstr_list_t args = cbstr_list_init(5);
+    cbstr_t package = cbstr_copy(&target->output);
+
+    cbstr_concat_cstr(&package, CB_CSTR(".dwp"));
+
+    cbstr_list_push(&args, CB_VIEW("dwp"));
+    cbstr_list_push(&args, CB_VIEW("-e"));
+    cbstr_list_push(&args, cbstr_copy(&target->output));
+    cbstr_list_push(&args, CB_VIEW("-o"));
+    cbstr_list_push(&args, package);
+
+    target->packaging = true;
+    cbjob_push(&build->pool, NULL, args, NULL, target->queue.target);
+}
+
+// Moves on from a finished link, archive or packaging command
+static void finish_link(build_t *build, target_t *target, int code) {
+    cbconf_t *conf = target->conf;
+
+    if (conf->type == TARGET_STATIC) {
+        if (code == 0 && target->replaced.len != 0) {
+            push_ar(build, target, "rcs", &target->replaced);
+            return;
+        }
+
+        if (code == 0) {
+            record_output(&target->output, target->link_command, &target->objects);
+        }
+    } else if (target->packaging) {
+        // The output itself is fine and already recorded either way
+    } else if (code == 0) {
+        if (conf->type == TARGET_SHARED) {
+            write_interface(&target->output);
+        }
+        record_output(&target->output, target->link_command, &target->inputs);
+
+        if (conf->debuginfo == DEBUG_INFO_SPLIT && conf->package_dwo) {
+            start_package(build, target);
+            return;
+        }
+    } else {
+        // This moves the cached file back to its original location. Only needed on windows as cache only works on windows
+        #ifdef _WIN32
+        if (conf->cache && conf->type == TARGET_EXECUTABLE) {
+            MoveFileA(target->temp.data, target->output.data);
+        }
+        #endif /* _WIN32 */
+    }
+
+    finish_target(build, target, code == 0);
+}
+
+// Links the target once all of its objects are built
+static void link_target(build_t *build, target_t *target) {
+    cbconf_t *conf = target->conf;
+    bool queued;
+
+    // Group objects are kept next to the objects and shared the same way
+    if (conf->type != TARGET_STATIC && conf->partial_link && conf->lto == LTO_OFF
+        && share_build(build, target, STAGE_PARTIAL, target->queue.command)) {
+        return;
+    }
 
-bool needs_compile(cbstr_t *object, dir_entry_t *file, cbstr_t *parent, tt_entry_t **entry) {
-    *entry = tt_search(&timetable, &file->filename, parent);
+    // Kept separate from the project name as watch mode compiles more than once
+    target->output = cbstr_with_cap(conf->project.len + conf->rule.len + 8);
+    output_name(conf, &target->output);
 
-    if (!(*entry)) {
-        return true;
+    target->temp = cbstr_with_cap(conf->rule.len + 16);
+    // Only used on windows so this is probably fine
+    cbstr_concat_format(&target->temp, CB_CSTR(".cbuild\\%s.tmp"), &target->output);
+
+    // Sorted so the same objects always make the same command
+    qsort(target->objects.strings, target->objects.len, sizeof(cbstr_t), compare_str);
+
+    target->stage = STAGE_LINK;
+
+    if (conf->type == TARGET_STATIC) {
+        queued = start_archive(build, target);
+    } else if (conf->partial_link && conf->lto == LTO_OFF) {
+        // Not with LTO, which would optimize each directory on its own
+        target->stage = STAGE_PARTIAL;
+
+        if (start_groups(build, target)) return;
+
+        target->stage = STAGE_LINK;
+        queued = start_link(build, target, &target->linked);
+    } else {
+        queued = start_link(build, target, &target->objects);
     }
 
-    if (file->write_time > (*entry)->write_time) {
-        return true;
+    if (!queued) {
+        finish_target(build, target, true);
     }
+}
+
+// Links the profile the instrumented copy of `object` wrote next to it, the
+// two are at the same place under each target's object directory
+static void link_profile(target_t *target, cbstr_t *object) {
+    cbstr_t *prefix = &target->instrumented->prefix;
 
-    return !file_exists(object->data);
+    cbstr_clear(&target->profile);
+    cbstr_concat_cstr(&target->profile, prefix->data, prefix->len - 1);
+    cbstr_concat_cstr(&target->profile, object->data + target->prefix.len - 1, object->len - target->prefix.len - 1);
+    cbstr_concat_cstr(&target->profile, CB_CSTR("gcda"));
+
+    gcda_path(object, &target->gcda);
+    create_parent_dir(&target->gcda);
+
+    // Gone if the file wasn't part of the training run, which leaves it
+    // without a stale one
+    file_link(target->profile.data, target->gcda.data);
 }
 
-void set_compiler_stub(cbconf_t *conf, cbstr_t *str) {
+// Works out which files of the target have to be compiled and queues them
+static void scan_target(build_t *build, target_t *target) {
+    cbconf_t *conf = target->conf;
+    dir_t *files = target->files;
+    compile_queue_t *queue = &target->queue;
     size_t i;
+    size_t sources = 0;
+    pending_list_t pending;
 
-    cbstr_concat_cstr(str, CB_CSTR("gcc -c "));
+    target->stage = STAGE_COMPILE;
 
-    for (i = 0; i < conf->defines.len; ++i) {
-        cbstr_concat_format(str, CB_CSTR("-D%s "), cbstr_list_get(&conf->defines, i));
-    }
+    // Rules with the same flags share objects, and going back to flags that
+    // were built before finds their objects still there. Targets with the
+    // same flags keep theirs apart by their source directory, and a new or
+    // updated compiler gets its own.
+    queue->command = cbhash_bytes(conf->source.data, conf->source.len, hash_command(&target->stub));
+    queue->command = cbhash_bytes(&target->toolchain.compiler, sizeof(uint64_t), queue->command);
+    snprintf(queue->command_hex, sizeof(queue->command_hex), "%016llx", (unsigned long long)queue->command);
 
-    for (i = 0; i < conf->flags.len; ++i) {
-        cbstr_concat_format(str, CB_CSTR("%s "), cbstr_list_get(&conf->flags, i));
+    if (share_build(build, target, STAGE_COMPILE, queue->command)) {
+        return;
     }
-}
 
-void compile(cbconf_t *conf, dir_t *files) {
-    #define FREE_ALL() cbstr_list_free(&objects);\
-    cbstr_free(&command);\
-    cbstr_free(&temp)
+    pending.len = 0;
+    pending.cap = 64;
+    pending.files = MALLOC(pending.cap * sizeof(pending_file_t));
 
-    size_t i;
-    int ret_val;
-    cbstr_t temp;
-    size_t stub_len;
-    cbstr_list_t objects = cbstr_list_init(files->entries.len >> 1);
-    bool built = false;
+    #ifdef _WIN32
+    cbstr_concat_cstr(&target->prefix, CB_CSTR("obj\\win32\\"));
+    #endif /* _WIN32 */
 
-    create_dir(".cbuild");
+    #ifdef __linux__
+    cbstr_concat_cstr(&target->prefix, CB_CSTR("obj/linux/"));
+    #endif /* __linux__ */
 
-    cbstr_t command = cbstr_with_cap(COMMAND_SIZE);
-    set_compiler_stub(conf, &command);
-    stub_len = command.len;
+    #ifdef __APPLE__
+    cbstr_concat_cstr(&target->prefix, CB_CSTR("obj/osx/"));
+    #endif /* __APPLE__ */
+
+    cbstr_concat_cstr(&target->prefix, queue->command_hex, 16);
+    cbstr_concat_cstr(&target->prefix, CB_CSTR("/"));
+    cbstr_localize_path(&target->prefix);
 
     for (i = 0; i < files->entries.len; ++i) {
         cbstr_t *parent;
-        cbstr_t object;
-        cbstr_t path;
         tt_entry_t *pentry;
+        file_state_t state;
+        pending_file_t item;
 
         dir_entry_t *file = entry_list_get(&files->entries, i);
         cbstr_t *name = &file->filename;
 
         if (name->data[name->len-2] != 'c') continue;
 
+        ++sources;
         parent = cbstr_list_get(&files->dir_names, file->parent);
 
-        path = cbstr_copy(parent);
-        cbstr_concat_format(&path, CB_CSTR("/%s"), name);
-
-        cbstr_localize_path(&path);
-
-        object = cbstr_with_cap(32);
-        #ifdef _WIN32
-        cbstr_concat_format(&object, CB_CSTR("obj\\win32\\%s\\"), &conf->rule);
-        #endif /* _WIN32 */
-
-        #ifdef __linux__
-        cbstr_concat_format(&object, CB_CSTR("obj/linux/%s/"), &conf->rule);
-        #endif /* __linux__ */
+        cbstr_clear(&target->path);
+        cbstr_concat(&target->path, parent);
+        cbstr_concat_format(&target->path, CB_CSTR("/%s"), name);
 
-        #ifdef __APPLE__
-        cbstr_concat_format(&object, CB_CSTR("obj/osx/%s/"), &conf->rule);
-        #endif /* __APPLE__ */
+        cbstr_localize_path(&target->path);
 
-        cbstr_concat_slice(&object, parent, conf->source.len);
-        create_dir(object.data);
+        cbstr_clear(&target->object);
+        cbstr_concat(&target->object, &target->prefix);
+        cbstr_concat_slice(&target->object, parent, conf->source.len);
         if (parent->len != conf->source.len) {
-            cbstr_concat_format(&object, CB_CSTR("/%s"), name);
+            cbstr_concat_format(&target->object, CB_CSTR("/%s"), name);
         } else {
-            cbstr_concat_format(&object, CB_CSTR("%s"), name);
+            cbstr_concat_format(&target->object, CB_CSTR("%s"), name);
         }
 
-        object.data[object.len-2] = 'o';
+        target->object.data[target->object.len-2] = 'o';
 
-        cbstr_localize_path(&object);
+        cbstr_localize_path(&target->object);
+
+        // Linked again after every training run, the ones that didn't
+        // change don't rebuild anything
+        if (target->trained) {
+            link_profile(target, &target->object);
+        }
 
-        command.len = stub_len;
-        cbstr_concat_format(&command, CB_CSTR("%s -o %s"), &path, &object);
+        state = file_state(&target->object, &target->path, file, parent, queue->command, &pentry);
 
-        if (!needs_compile(&object, file, parent, &pentry)) {
-            printf("[INFO] %s up to date\n", path.data);
-            cbstr_list_push(&objects, cbstr_copy(&pentry->obj_file));
-            cbstr_free(&object);
-            cbstr_free(&path);
+        if (state == FILE_UP_TO_DATE) {
+            printf("[INFO] %s up to date\n", target->path.data);
+            cbstr_list_push(&target->objects, cbstr_arena_copy(&target->arena, &target->object));
             continue;
         }
 
-        cbstr_free(&path);
-        cbstr_list_push(&objects, object);
-        built = true;
+        item.file = file;
+        item.path = cbstr_arena_copy(&target->arena, &target->path);
+        item.object = cbstr_arena_copy(&target->arena, &target->object);
+        item.batch.len = 0;
+        item.build = state == FILE_BUILD;
 
-        printf("[CMD] %s\n", command.data);
-        ret_val = system(command.data);
+        if (pentry != NULL) {
+            cbstr_t obj_file = tt_string(&timetable, pentry->obj_file);
 
-        if (ret_val == 0) {
-            if (pentry == NULL) {
-                tt_entry_t entry;
-                entry.file_name = cbstr_copy(name);
-                entry.parent_dirs = cbstr_copy(parent);
-                entry.obj_file = cbstr_copy(&object);
-                entry.write_time = file->write_time;
+            if (!cbstr_cmp(&obj_file, &target->object)) {
+                item.batch = cbstr_arena_copy(&target->arena, &obj_file);
+            }
+        }
 
-                tt_push(&timetable, entry);
-            } else {
-                cbstr_free(&pentry->obj_file);
-                pentry->obj_file = cbstr_copy(&object);
-                pentry->write_time = file->write_time;
+        pending_push(&pending, item);
+    }
+
+    reuse_batches(&pending, &target->objects);
+    target->built = pending.len != 0;
+
+    // Unity batches are only worth it when everything has to be compiled,
+    // otherwise only the files that changed are
+    if (conf->unity && pending.len == sources && pending.len > 1) {
+        push_unity_batches(conf, files, queue, &pending, &target->path);
+    } else {
+        for (i = 0; i < pending.len; ++i) {
+            push_file(queue, &pending.files[i]);
+        }
+    }
+
+    FREE(pending.files);
+
+    if (queue->running == 0) {
+        link_target(build, target);
+    }
+}
+
+// Moves a unit on from a finished job. The timetable is updated as each
+// object finishes so a failed build keeps whatever did compile.
+static void finish_unit(build_t *build, target_t *target, cbjob_t *job, proc_status_t *status) {
+    compile_unit_t *unit = job->data;
+    compile_queue_t *queue = &target->queue;
+    cbstr_t *pch = target->conf->pch.data != NULL ? &target->gch : NULL;
+
+    if (queue->cache != NULL && !unit->preprocessed) {
+        cbtrace_job("preprocess", unit->source.data, job->start, job->end, job->slot, status->code);
+
+        if (status->code == 0) {
+            unit->preprocessed = true;
+
+            if (!fetch_unit(queue, unit, &target->object)) {
+                // `job` can't be used after this, pushing may move it
+                push_unit(queue, unit);
+                return;
+            }
+
+            printf("[INFO] %s found in the object cache\n", unit->source.data);
+            record_unit(target->files, unit, queue->command, pch, target->conf->pgo == PGO_USE);
+        }
+    } else {
+        cbtrace_job("compile", unit->source.data, job->start, job->end, job->slot, status->code);
+
+        if (status->code == 0) {
+            record_unit(target->files, unit, queue->command, pch, target->conf->pgo == PGO_USE);
+
+            if (queue->cache != NULL && unit->key != 0) {
+                cbcache_store(queue->cache, unit->key, unit->object.data);
             }
-        } else {
-            eprintf("[ERROR] '%s' failed with code %d!\n", command.data, ret_val);
-            FREE_ALL();
-            return;
         }
     }
 
-    #ifdef _WIN32
-    cbstr_concat_format(&conf->project, CB_CSTR("-%s.exe"), &conf->rule);
-    #endif /* _WIN32 */
+    if (status->code != 0) {
+        target->stage = STAGE_FAILED;
+    }
+
+    if (--queue->running != 0) return;
+
+    // Nothing new gets to run once anything failed
+    if (target->stage == STAGE_FAILED || build->pool.failed) {
+        finish_target(build, target, false);
+        resume_shared(build, target, false);
+    } else {
+        link_target(build, target);
+        resume_shared(build, target, true);
+    }
+}
+
+static bool depends_on(target_t *target, cbstr_t *name) {
+    size_t i;
+
+    for (i = 0; i < target->conf->depends.len; ++i) {
+        if (cbstr_cmp(cbstr_list_get(&target->conf->depends, i), name)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+// Queues a training run of the instrumented copy, unless it already ran
+// since it was last linked with the same arguments. Returns false if there
+// was nothing to do.
+static bool start_train(build_t *build, target_t *target) {
+    cbconf_t *conf = target->conf;
+    target_t *instrumented = NULL;
+    cbstr_t *output;
+    cbstr_t program;
+    cbstr_list_t args;
+    size_t i;
+
+    for (i = 0; i < build->count; ++i) {
+        if (cbstr_cmp(&build->targets[i].conf->project, &conf->instrumented)) {
+            instrumented = &build->targets[i];
+        }
+    }
+
+    target->instrumented = instrumented;
+    output = &instrumented->output;
+
+    program = cbstr_with_cap(output->len + 2);
+    // Not looked up in the PATH with a slash in it
     #ifdef UNIX
-    cbstr_concat_format(&conf->project, CB_CSTR("-%s.out"), &conf->rule);
+    cbstr_concat_cstr(&program, CB_CSTR("./"));
     #endif /* UNIX */
+    cbstr_concat(&program, output);
 
-    temp = cbstr_with_cap(conf->rule.len + 16);
-    // Only used on windows so this is probably fine
-    cbstr_concat_format(&temp, CB_CSTR(".cbuild\\%s.tmp"), &conf->project);
+    args = cbstr_list_init(conf->train.len + 1);
+    cbstr_list_push(&args, program);
+
+    for (i = 0; i < conf->train.len; ++i) {
+        cbstr_list_push(&args, cbstr_copy(cbstr_list_get(&conf->train, i)));
+    }
+
+    target->train_command = hash_command(&args);
+
+    if (output_up_to_date(output, target->train_command)) {
+        printf("[INFO] %s already trained\n", output->data);
+        cbstr_list_free(&args);
+        return false;
+    }
+
+    // The counts of every run would add up otherwise
+    for (i = 0; i < instrumented->objects.len; ++i) {
+        cbstr_t *object = &instrumented->objects.strings[i];
+
+        gcda_path(object, &target->gcda);
+        remove(target->gcda.data);
+    }
+
+    target->stage = STAGE_TRAIN;
+    cbjob_push(&build->pool, NULL, args, NULL, target->queue.target);
+    return true;
+}
+
+// Builds the pch if there is one, then works out what to compile
+static void compile_target(build_t *build, target_t *target) {
+    target->stage = STAGE_COMPILE;
 
-    if (!built && timetable.build_success && file_exists(conf->project.data)) {
-        printf("[INFO] %s up to date\n", conf->project.data);
-        FREE_ALL();
+    if (target->conf->pch.data != NULL) {
+        if (!start_pch(build, target)) {
+            finish_target(build, target, false);
+            return;
+        }
+
+        if (target->stage == STAGE_PCH || target->stage == STAGE_PCH_SHARED) return;
+    }
+
+    scan_target(build, target);
+}
+
+static void finish_train(build_t *build, target_t *target, int code) {
+    cbstr_list_t none = {.strings = NULL, .len = 0, .cap = 0};
+
+    if (code != 0) {
+        finish_target(build, target, false);
         return;
     }
 
-    // Cache only does stuff on windows
-    #ifdef _WIN32
-    if (conf->cache) {
-        printf("[INFO] Relocating executable to cache...\n");
-        DeleteFileA(temp.data);
-        MoveFileA(conf->project.data, temp.data);
+    record_output(&target->instrumented->output, target->train_command, &none);
+    target->trained = true;
+    compile_target(build, target);
+}
+
+static void start_target(build_t *build, target_t *target) {
+    cbconf_t *conf = target->conf;
+    const char *linker = conf->linker.data;
+
+    target->stage = STAGE_COMPILE;
+
+    if (!cbtoolchain_probe(&target->toolchain, compiler(conf), link_driver(conf), linker, ".cbuild/toolchain")) {
+        eprintf("[ERROR] Could not run the compiler '%s'.\n", compiler(conf));
+        finish_target(build, target, false);
+        return;
     }
-    #endif /* _WIN32 */
 
-    cbstr_clear(&command);
-    cbstr_concat_format(&command, CB_CSTR("gcc -g -o %s "), &conf->project);
+    if (linker != NULL && !target->toolchain.fuse_ld) {
+        eprintf("[WARNING] '%s' doesn't take -fuse-ld=%s, linking with its default linker.\n", link_driver(conf), linker);
+    }
 
-    for (i = 0; i < objects.len; ++i) {
-        cbstr_concat_format(&command, CB_CSTR("%s "), cbstr_list_get(&objects, i));
+    // clang's profiles have to be merged with llvm-profdata first
+    if (conf->pgo != PGO_OFF && target->toolchain.clang) {
+        eprintf("[ERROR] Target '%s' can't use pgo with clang.\n", conf->project.data);
+        finish_target(build, target, false);
+        return;
     }
 
-    printf("[CMD] %s\n", command.data);
-    ret_val = system(command.data);
+    target->queue.compiler = target->toolchain.compiler;
+    set_compiler_stub(conf, &target->toolchain, &target->stub);
 
-    timetable.build_success = ret_val == 0;
+    if (conf->pgo == PGO_USE && start_train(build, target)) return;
 
-    if (!timetable.build_success) {
-        eprintf("[ERROR] '%s' failed with code %d!\n", command.data, ret_val);
-        // This moves the cached file back to its original location. Only needed on windows as cache only works on windows
-        #ifdef _WIN32
-        MoveFileA(temp.data, conf->project.data);
-        #endif /* _WIN32 */
+    compile_target(build, target);
+}
+
+// Starts every target that was only waiting on this one
+static void finish_target(build_t *build, target_t *target, bool ok) {
+    size_t i;
+
+    target->stage = ok ? STAGE_DONE : STAGE_FAILED;
+
+    if (!ok) return;
+
+    for (i = 0; i < build->count; ++i) {
+        target_t *other = &build->targets[i];
+
+        if (other->stage != STAGE_WAITING || !depends_on(other, &target->conf->project)) continue;
+
+        if (--other->waiting == 0) {
+            start_target(build, other);
+        }
+    }
+}
+
+static void target_init(build_t *build, size_t index, cbconf_t *conf, dir_t *files) {
+    target_t *target = &build->targets[index];
+    cbstr_t empty = {.data = NULL, .len = 0, .capacity = 0};
+    cbstr_list_t empty_list = {.strings = NULL, .len = 0, .cap = 0};
+
+    target->conf = conf;
+    target->files = files;
+    target->stage = STAGE_WAITING;
+    // Probed once the target starts
+    target->toolchain.compiler = 0;
+    target->toolchain.version = empty;
+    target->toolchain.fuse_ld = false;
+    target->toolchain.clang = false;
+    target->waiting = conf->depends.len;
+    target->sharing = NULL;
+    target->built = false;
+    target->arena = cbarena_init(COMPILE_ARENA_BLOCK);
+    target->stub = cbstr_list_init(8 + conf->defines.len + conf->flags.len);
+    target->objects = cbstr_list_init(files->entries.len >> 1);
+    target->path = cbstr_with_cap(256);
+    target->object = cbstr_with_cap(256);
+    target->prefix = cbstr_with_cap(32);
+    target->gch = cbstr_with_cap(64);
+    // Only made once the target links
+    target->output = empty;
+    target->temp = empty;
+    target->inputs = empty_list;
+    target->replaced = empty_list;
+    target->packaging = false;
+    target->instrumented = NULL;
+    target->trained = false;
+    target->profile = cbstr_with_cap(64);
+    target->gcda = cbstr_with_cap(64);
+    target->groups = NULL;
+    target->group_count = 0;
+    target->group_running = 0;
+    target->linked = empty_list;
+
+    target->queue.pool = &build->pool;
+    target->queue.stub = &target->stub;
+    target->queue.arena = &target->arena;
+    target->queue.objects = &target->objects;
+    // The cache only keeps objects, not the .dwo files next to them. It
+    // doesn't know about profiles either, and instrumented objects write
+    // theirs to wherever they were first built.
+    target->queue.cache = conf->debuginfo == DEBUG_INFO_SPLIT || conf->pgo != PGO_OFF ? NULL : build->cache;
+    target->queue.running = 0;
+    target->queue.target = index;
+    target->queue.compiler = 0;
+}
+
+static void target_free(target_t *target) {
+    size_t i;
+
+    for (i = 0; i < target->group_count; ++i) {
+        cbstr_list_free(&target->groups[i].objects);
+    }
+
+    if (target->groups != NULL) {
+        FREE(target->groups);
+    }
+
+    cbtoolchain_free(&target->toolchain);
+    cbstr_list_free(&target->linked);
+    cbstr_list_free(&target->objects);
+    cbstr_list_free(&target->stub);
+    cbstr_list_free(&target->inputs);
+    cbstr_list_free(&target->replaced);
+    cbstr_free(&target->path);
+    cbstr_free(&target->object);
+    cbstr_free(&target->prefix);
+    cbstr_free(&target->gch);
+    cbstr_free(&target->profile);
+    cbstr_free(&target->gcda);
+    cbstr_free(&target->output);
+    cbstr_free(&target->temp);
+    cbarena_free(&target->arena);
+}
+
+// Builds every target on one job pool. A target starts once everything it
+// depends on is done, and targets that don't depend on each other compile
+// side by side. Returns false if any target failed or never got to start.
+bool build_targets(cbconf_t *config, cbconf_t *targets, dir_t **files, size_t count) {
+    build_t build;
+    cbcache_t cache;
+    cbjob_t *job;
+    proc_status_t status;
+    size_t i;
+    bool ok;
+
+    build.pool = cbjob_pool_init(config->jobs);
+    build.targets = MALLOC(count * sizeof(target_t));
+    build.count = count;
+    build.cache = NULL;
+
+    create_dir(".cbuild");
+    tt_begin_build(&timetable);
+
+    if (config->object_cache) {
+        if (cbcache_open(&cache, config->object_cache_dir.data, (uint64_t)config->object_cache_size << 20)) {
+            build.cache = &cache;
+        } else {
+            eprintf("[WARNING] Could not open the object cache, building without it.\n");
+        }
+    }
+
+    for (i = 0; i < count; ++i) {
+        target_init(&build, i, &targets[i], files[i]);
+    }
+
+    // Starting one target can finish it and start others further on
+    for (i = 0; i < count; ++i) {
+        if (build.targets[i].stage == STAGE_WAITING && build.targets[i].waiting == 0) {
+            start_target(&build, &build.targets[i]);
+        }
+    }
+
+    // Every job goes back to the target it came from, which queues whatever
+    // it needs next
+    while (cbjob_pool_wait(&build.pool, &job, &status)) {
+        target_t *target = &build.targets[job->tag];
+
+        if (target->stage == STAGE_PARTIAL) {
+            finish_group(&build, target, job, &status);
+        } else if (job->data != NULL) {
+            finish_unit(&build, target, job, &status);
+        } else if (target->stage == STAGE_TRAIN) {
+            cbtrace_job("train", target->instrumented->output.data, job->start, job->end, job->slot, status.code);
+            finish_train(&build, target, status.code);
+        } else if (target->stage == STAGE_PCH) {
+            cbtrace_job("pch", target->conf->pch.data, job->start, job->end, job->slot, status.code);
+            finish_pch(&build, target, status.code);
+        } else {
+            const char *name = target->conf->type == TARGET_STATIC ? "archive" : target->packaging ? "package" : "link";
+            cbtrace_job(name, target->output.data, job->start, job->end, job->slot, status.code);
+            finish_link(&build, target, status.code);
+        }
+    }
+
+    if (build.cache != NULL && cache.hits + cache.misses != 0) {
+        printf("[INFO] Object cache: %llu hits, %llu misses\n", (unsigned long long)cache.hits, (unsigned long long)cache.misses);
+    }
+
+    close_cache(build.cache);
+
+    ok = !build.pool.failed;
+
+    for (i = 0; i < count; ++i) {
+        ok = ok && build.targets[i].stage == STAGE_DONE;
+        target_free(&build.targets[i]);
     }
 
-    FREE_ALL();
-    #undef FREE_ALL
+    FREE(build.targets);
+    cbjob_pool_free(&build.pool);
+
+    return ok;
 }
 
 cbconf_t load_config(int argc, char **argv) {
@@ -227,57 +2050,279 @@ cbconf_t load_config(int argc, char **argv) {
 }
 
 void load_timetable(cbstr_t path) {
-    FILE *timetable_file;
-
-    timetable_file = fopen(path.data, "rb");
-
-    if (timetable_file) {
-        tt_load(&timetable, timetable_file);
-        fclose(timetable_file);
-    } else {
+    if (!tt_load(&timetable, path.data)) {
         printf("[WARNING] Could not open timetable file.\n");
-        timetable = tt_init(4);
     }
 }
 
 void save_timetable(cbstr_t path) {
-    FILE *timetable_file;
+    tt_save(&timetable, path.data);
+}
+
+// The source directories of every target, each walked once however many
+// targets build from it
+typedef struct sources {
+    dir_t *trees;
+    // Views of the directory each tree was walked from
+    cbstr_t *roots;
+    size_t len;
+    // The tree of each target
+    dir_t **files;
+} sources_t;
+
+static sources_t walk_sources(cbconf_t *targets, size_t count, size_t threads) {
+    sources_t sources;
+    size_t i;
+    size_t j;
 
-    timetable_file = fopen(path.data, "wb");
+    sources.trees = MALLOC(count * sizeof(dir_t));
+    sources.roots = MALLOC(count * sizeof(cbstr_t));
+    sources.files = MALLOC(count * sizeof(dir_t*));
+    sources.len = 0;
 
-    if (timetable_file) {
-        tt_save(&timetable, timetable_file);
-        fclose(timetable_file);
-    } else {
-        printf("[WARNING] Could not open timetable file.\n");
+    for (i = 0; i < count; ++i) {
+        for (j = 0; j < sources.len && !cbstr_cmp(&sources.roots[j], &targets[i].source); ++j);
+
+        if (j == sources.len) {
+            sources.roots[j] = targets[i].source;
+            sources.trees[j] = walk_dir(targets[i].source, threads);
+            ++sources.len;
+        }
+
+        sources.files[i] = &sources.trees[j];
+    }
+
+    return sources;
+}
+
+static void sources_free(sources_t *sources) {
+    size_t i;
+
+    for (i = 0; i < sources->len; ++i) {
+        dir_free(&sources->trees[i]);
+    }
+
+    FREE(sources->trees);
+    FREE(sources->roots);
+    FREE(sources->files);
+}
+
+// Checks the targets `index` depends on exist and don't depend on it in turn,
+// then has it link against the libraries among them. A static library brings
+// along everything it links against as well. `state` is 1 for targets being
+// resolved and 2 for ones that are done.
+static bool resolve_target(cbconf_t *targets, size_t count, size_t index, uint8_t *state) {
+    cbconf_t *target = &targets[index];
+    size_t i;
+    size_t j;
+    size_t k;
+
+    if (state[index] == 2) return true;
+
+    if (state[index] == 1) {
+        eprintf("[ERROR] Target '%s' is part of a dependency cycle.\n", target->project.data);
+        return false;
+    }
+
+    state[index] = 1;
+
+    for (i = 0; i < target->depends.len; ++i) {
+        cbstr_t *name = cbstr_list_get(&target->depends, i);
+        cbconf_t *dependency;
+        cbstr_t output;
+
+        for (j = 0; j < count && !cbstr_cmp(&targets[j].project, name); ++j);
+
+        if (j == count) {
+            eprintf("[ERROR] Target '%s' depends on unknown target '%s'.\n", target->project.data, name->data);
+            return false;
+        }
+
+        if (!resolve_target(targets, count, j, state)) return false;
+
+        dependency = &targets[j];
+        if (dependency->type == TARGET_EXECUTABLE) continue;
+
+        output = cbstr_with_cap(dependency->project.len + dependency->rule.len + 8);
+        output_name(dependency, &output);
+        cbstr_list_push(&target->libs, output);
+
+        if (dependency->type != TARGET_STATIC) continue;
+
+        for (k = 0; k < dependency->libs.len; ++k) {
+            cbstr_list_push(&target->libs, cbstr_copy(cbstr_list_get(&dependency->libs, k)));
+        }
+    }
+
+    state[index] = 2;
+    return true;
+}
+
+static bool resolve_targets(cbconf_t *targets, size_t count) {
+    uint8_t *state = MALLOC(count);
+    bool ok = true;
+    size_t i;
+
+    memset(state, 0, count);
+
+    for (i = 0; i < count && ok; ++i) {
+        ok = resolve_target(targets, count, i, state);
+    }
+
+    FREE(state);
+    return ok;
+}
+
+// Directories are tagged with their index counting across every tree
+static void watch_tree(dir_watch_t *watch, sources_t *sources) {
+    size_t i;
+    size_t j;
+    size_t tag = 0;
+
+    dir_watch_clear(watch);
+
+    for (i = 0; i < sources->len; ++i) {
+        dir_t *files = &sources->trees[i];
+
+        for (j = 0; j < files->dir_names.len; ++j, ++tag) {
+            cbstr_t *dir = cbstr_list_get(&files->dir_names, j);
+
+            if (!dir_watch_add(watch, dir->data, tag)) {
+                eprintf("[WARNING] Could not watch '%s', changes to it will be missed.\n", dir->data);
+            }
+        }
+    }
+}
+
+// Only sources and headers can change the build, this also keeps objects
+// written under the source directory from triggering another build
+static bool affects_build(cbstr_t *name) {
+    return name->len > 3 && name->data[name->len-3] == '.' && (name->data[name->len-2] == 'c' || name->data[name->len-2] == 'h');
+}
+
+static void print_watching(sources_t *sources) {
+    size_t i;
+
+    for (i = 0; i < sources->len; ++i) {
+        printf("[INFO] Watching '%s' for changes...\n", sources->roots[i].data);
     }
+    fflush(stdout);
+}
+
+// Rebuilds every time something changes until the process is killed. The
+// walked trees and timetable are kept around and only updated from the events.
+// Only returns if watching stopped working.
+void watch(cbconf_t *config, cbconf_t *targets, size_t count, sources_t *sources, cbstr_t timetable_path) {
+    dir_watch_t watch;
+    size_t i;
+    size_t j;
+
+    if (!dir_watch_init(&watch)) {
+        eprintf("[ERROR] Watch mode is not supported on this platform.\n");
+        return;
+    }
+
+    watch_tree(&watch, sources);
+    trust_objects = true;
+    print_watching(sources);
+
+    while (dir_watch_wait(&watch, WATCH_DEBOUNCE_MS)) {
+        bool rebuild = watch.rescan;
+
+        if (watch.rescan) {
+            for (i = 0; i < sources->len; ++i) {
+                dir_free(&sources->trees[i]);
+                TRACE_PHASE("walk_dir", sources->trees[i] = walk_dir(sources->roots[i], config->walk_threads));
+            }
+            watch_tree(&watch, sources);
+        } else {
+            for (i = 0; i < watch.events_len; ++i) {
+                watch_event_t *event = &watch.events[i];
+                size_t dir = event->dir;
+
+                if (!affects_build(&event->name)) continue;
+
+                for (j = 0; dir >= sources->trees[j].dir_names.len; ++j) {
+                    dir -= sources->trees[j].dir_names.len;
+                }
+
+                dir_refresh_file(&sources->trees[j], dir, &event->name);
+                rebuild = true;
+            }
+        }
+
+        if (!rebuild) continue;
+
+        TRACE_PHASE("build", build_targets(config, targets, sources->files, count));
+        TRACE_PHASE("tt_save", save_timetable(timetable_path));
+
+        print_watching(sources);
+    }
+
+    eprintf("[ERROR] Stopped receiving changes.\n");
+    dir_watch_free(&watch);
 }
 
 int cb_main(int argc, char **argv) {
     cbconf_t config;
-    dir_t files;
+    cbconf_t *targets;
+    size_t count;
+    sources_t sources;
     cbstr_t timetable_path;
 
+    int64_t start;
+    bool ok;
+
     DEBUG_INIT();
 
+    // The trace file isn't known until the config is loaded
+    start = monotonic_ns();
     config = load_config(argc, argv);
-    files = walk_dir(config.source);
 
-    timetable_path = cbstr_with_cap(19 + config.rule.len);
-    cbstr_concat_format(&timetable_path, CB_CSTR(".cbuild/%s-timetable"), &config.rule);
+    if (config.trace != NULL && !cbtrace_open(config.trace, start)) {
+        eprintf("[WARNING] Could not open trace file '%s'.\n", config.trace);
+    }
+
+    // A config without target blocks is its own only target
+    if (config.target_count == 0) {
+        targets = &config;
+        count = 1;
+    } else {
+        targets = config.targets;
+        count = config.target_count;
+    }
+
+    if (!resolve_targets(targets, count)) {
+        cbconf_free(&config);
+        cbtrace_close();
+        DEBUG_DEINIT();
+        return 1;
+    }
 
-    load_timetable(timetable_path);
+    cbtrace_phase("load_config", start, monotonic_ns());
 
-    compile(&config, &files);
+    TRACE_PHASE("walk_dir", sources = walk_sources(targets, count, config.walk_threads));
 
-    save_timetable(timetable_path);
+    // Shared by every rule, entries are kept apart by the command that built them
+    timetable_path = cbstr_from_lit(".cbuild/timetable");
+    cbstr_localize_path(&timetable_path);
+
+    TRACE_PHASE("tt_load", load_timetable(timetable_path));
+    TRACE_PHASE("build", ok = build_targets(&config, targets, sources.files, count));
+    TRACE_PHASE("tt_save", save_timetable(timetable_path));
+
+    if (config.watch) {
+        watch(&config, targets, count, &sources, timetable_path);
+        ok = false;
+    }
 
     tt_free(&timetable);
     cbstr_free(&timetable_path);
-    dir_free(&files);
+    sources_free(&sources);
     cbconf_free(&config);
-    
+    cbtrace_close();
+
     DEBUG_DEINIT();
 
-    return 0;
+    return ok ? 0 : 1;
 }
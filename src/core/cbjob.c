@@ -0,0 +1,258 @@
+/// Author - zebubull
+/// cbjob.c
+/// cbjob.h implementation.
+/// Copyright (c) zebubull 2023
+#include "cbjob.h"
+
+#include "../mem/cbmem.h"
+#include "../util/cblog.h"
+#include "../os/time.h"
+#include "../os/dir.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+cbjob_pool_t cbjob_pool_init(size_t workers) {
+    cbjob_pool_t pool;
+
+    if (workers == 0) {
+        workers = 1;
+    }
+
+    #ifdef _WIN32
+    // WaitForMultipleObjects can't wait on any more than this
+    if (workers > MAXIMUM_WAIT_OBJECTS) {
+        workers = MAXIMUM_WAIT_OBJECTS;
+    }
+    #endif /* _WIN32 */
+
+    pool.len = 0;
+    pool.cap = 8;
+    pool.next = 0;
+    pool.jobs = MALLOC(pool.cap * sizeof(cbjob_t));
+    pool.procs = MALLOC(workers * sizeof(proc_t));
+    pool.running = MALLOC(workers * sizeof(size_t));
+    pool.slot_busy = MALLOC(workers * sizeof(bool));
+    memset(pool.slot_busy, 0, workers * sizeof(bool));
+    pool.active = 0;
+    pool.workers = workers;
+    pool.argv_cap = 32;
+    pool.argv = MALLOC(pool.argv_cap * sizeof(char*));
+    pool.line = cbstr_with_cap(256);
+    pool.failed = false;
+
+    return pool;
+}
+
+void cbjob_pool_free(cbjob_pool_t *pool) {
+    size_t i;
+
+    for (i = 0; i < pool->len; ++i) {
+        cbstr_list_free(&pool->jobs[i].args);
+    }
+
+    FREE(pool->jobs);
+    FREE(pool->procs);
+    FREE(pool->running);
+    FREE(pool->slot_busy);
+    FREE(pool->argv);
+    cbstr_free(&pool->line);
+}
+
+void cbjob_push(cbjob_pool_t *pool, cbstr_list_t *stub, cbstr_list_t args, void *data, size_t tag) {
+    cbjob_t *job;
+
+    if (pool->len == pool->cap) {
+        pool->cap = (pool->cap << 1) - (pool->cap >> 1);
+        pool->jobs = REALLOC(pool->jobs, pool->cap * sizeof(cbjob_t));
+    }
+
+    job = &pool->jobs[pool->len];
+    job->stub = stub;
+    job->args = args;
+    job->data = data;
+    job->tag = tag;
+    ++pool->len;
+}
+
+static void push_arg(cbjob_pool_t *pool, size_t *len, char *arg) {
+    if (*len == pool->argv_cap) {
+        pool->argv_cap <<= 1;
+        pool->argv = REALLOC(pool->argv, pool->argv_cap * sizeof(char*));
+    }
+
+    pool->argv[*len] = arg;
+    ++*len;
+}
+
+// Response files are split on whitespace, and quotes and backslashes escape
+static void write_rsp_arg(FILE *file, const char *arg) {
+    if (*arg == 0) {
+        fputs("\"\"", file);
+    }
+
+    for (; *arg != 0; ++arg) {
+        if (*arg == '\\' || *arg == '"' || *arg == '\'' || isspace((unsigned char)*arg)) {
+            fputc('\\', file);
+        }
+        fputc(*arg, file);
+    }
+
+    fputc('\n', file);
+}
+
+// Moves every argument after the program into a response file named after
+// the job's slot, so no two running jobs share one. It is only written if
+// `write` is set. Returns false if it couldn't be written.
+static bool use_rsp(cbjob_pool_t *pool, cbjob_t *job, bool write) {
+    char *path = pool->rsp_arg + 1;
+    char **arg;
+    FILE *file;
+
+    snprintf(pool->rsp_arg, sizeof(pool->rsp_arg), "@.cbuild/rsp/%llu.rsp", (unsigned long long)job->slot);
+
+    if (write) {
+        create_dir(".cbuild");
+        create_dir(".cbuild/rsp");
+        file = fopen(path, "wb");
+
+        if (file == NULL) {
+            return false;
+        }
+
+        for (arg = pool->argv + 1; *arg != NULL; ++arg) {
+            write_rsp_arg(file, *arg);
+        }
+
+        fclose(file);
+    }
+
+    pool->argv[1] = pool->rsp_arg;
+    pool->argv[2] = NULL;
+    return true;
+}
+
+// Fills in argv for the job, `write` is passed on to use_rsp for long ones
+static void build_argv(cbjob_pool_t *pool, cbjob_t *job, bool write) {
+    size_t i;
+    size_t len = 0;
+    size_t line = 0;
+
+    if (job->stub != NULL) {
+        for (i = 0; i < job->stub->len; ++i) {
+            push_arg(pool, &len, job->stub->strings[i].data);
+            line += job->stub->strings[i].len;
+        }
+    }
+
+    for (i = 0; i < job->args.len; ++i) {
+        push_arg(pool, &len, job->args.strings[i].data);
+        line += job->args.strings[i].len;
+    }
+
+    push_arg(pool, &len, NULL);
+
+    if (line > CBJOB_RSP_THRESHOLD && !use_rsp(pool, job, write)) {
+        eprintf("[WARNING] Could not write '%s', passing the arguments directly.\n", pool->rsp_arg + 1);
+    }
+}
+
+// Joins the arguments back together for printing, only arguments with
+// spaces in them are quoted.
+static char *format_line(cbjob_pool_t *pool) {
+    char **arg;
+
+    cbstr_clear(&pool->line);
+
+    for (arg = pool->argv; *arg != NULL; ++arg) {
+        if (arg != pool->argv) {
+            cbstr_concat_cstr(&pool->line, CB_CSTR(" "));
+        }
+
+        if (strchr(*arg, ' ') != NULL) {
+            cbstr_concat_cstr(&pool->line, CB_CSTR("\""));
+            cbstr_concat_cstr(&pool->line, *arg, strlen(*arg) + 1);
+            cbstr_concat_cstr(&pool->line, CB_CSTR("\""));
+        } else {
+            cbstr_concat_cstr(&pool->line, *arg, strlen(*arg) + 1);
+        }
+    }
+
+    return pool->line.data;
+}
+
+static void report_failure(cbjob_pool_t *pool, cbjob_t *job, proc_status_t *status) {
+    // The response file is still there from when it started
+    build_argv(pool, job, false);
+
+    if (status->signal != 0) {
+        #ifdef UNIX
+        eprintf("[ERROR] '%s' was killed by signal %d (%s)!\n", format_line(pool), status->signal, strsignal(status->signal));
+        #endif /* UNIX */
+    } else {
+        eprintf("[ERROR] '%s' failed with code %d!\n", format_line(pool), status->code);
+    }
+}
+
+bool cbjob_pool_wait(cbjob_pool_t *pool, cbjob_t **job, proc_status_t *status) {
+    size_t done;
+
+    while (!pool->failed && pool->next < pool->len && pool->active < pool->workers) {
+        cbjob_t *next = &pool->jobs[pool->next];
+
+        // There is always a free slot while a worker is free
+        for (next->slot = 0; pool->slot_busy[next->slot]; ++next->slot);
+
+        build_argv(pool, next, true);
+        printf("[CMD] %s\n", format_line(pool));
+        fflush(stdout);
+
+        next->start = monotonic_ns();
+
+        if (!proc_spawn(pool->argv, &pool->procs[pool->active])) {
+            next->end = next->start;
+            eprintf("[ERROR] Failed to start '%s'!\n", pool->argv[0]);
+            pool->failed = true;
+            *job = next;
+            status->code = -1;
+            status->signal = 0;
+            ++pool->next;
+            return true;
+        }
+
+        pool->running[pool->active] = pool->next;
+        pool->slot_busy[next->slot] = true;
+        ++pool->active;
+        ++pool->next;
+    }
+
+    if (pool->active == 0) {
+        return false;
+    }
+
+    done = proc_wait_any(pool->procs, pool->active, status);
+
+    if (done == pool->active) {
+        eprintf("[ERROR] Lost track of running jobs!\n");
+        pool->failed = true;
+        pool->active = 0;
+        return false;
+    }
+
+    *job = &pool->jobs[pool->running[done]];
+    (*job)->end = monotonic_ns();
+    pool->slot_busy[(*job)->slot] = false;
+
+    // Keep running processes packed at the front
+    --pool->active;
+    pool->procs[done] = pool->procs[pool->active];
+    pool->running[done] = pool->running[pool->active];
+
+    if (status->code != 0) {
+        report_failure(pool, *job, status);
+        pool->failed = true;
+    }
+
+    return true;
+}
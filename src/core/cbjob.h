@@ -0,0 +1,70 @@
+/// Author - zebubull
+/// cbjob.h
+/// A header for running compiler commands in parallel.
+/// Copyright (c) zebubull 2023
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "../os/proc.h"
+#include "../util/cbstr.h"
+
+// Commands are kept as argument vectors and never go through a shell.
+// The arguments are `stub` followed by `args`.
+
+// Longer command lines have their arguments moved into a response file under
+// .cbuild/rsp. Windows can't start anything longer, and it keeps linux well
+// clear of ARG_MAX.
+#define CBJOB_RSP_THRESHOLD 32000
+typedef struct cbjob {
+    // Shared between jobs (e.g. the compiler and its flags) and not owned
+    // by the job, may be NULL
+    cbstr_list_t *stub;
+    cbstr_list_t args;
+    // Caller defined, handed back untouched when the job finishes
+    void *data;
+    size_t tag;
+
+    // Filled in by the pool, times are from monotonic_ns
+    int64_t start;
+    int64_t end;
+    // Worker slot the job ran in, no two running jobs share one
+    size_t slot;
+} cbjob_t;
+
+typedef struct cbjob_pool {
+    cbjob_t *jobs;
+    size_t len;
+    size_t cap;
+    // Index of the next job to launch
+    size_t next;
+
+    // Running processes and the job each one belongs to
+    proc_t *procs;
+    size_t *running;
+    bool *slot_busy;
+    size_t active;
+    size_t workers;
+
+    // Scratch space reused for every launch
+    char **argv;
+    size_t argv_cap;
+    cbstr_t line;
+    // The @file argument of the last command moved into a response file
+    char rsp_arg[32];
+
+    bool failed;
+} cbjob_pool_t;
+
+cbjob_pool_t cbjob_pool_init(size_t workers);
+void cbjob_pool_free(cbjob_pool_t *pool);
+
+// Queues a command, the pool takes ownership of `args` but not `stub`,
+// which has to outlive the pool.
+void cbjob_push(cbjob_pool_t *pool, cbstr_list_t *stub, cbstr_list_t args, void *data, size_t tag);
+
+// Launches queued jobs until every worker is busy, then waits for one of
+// them to finish. Returns false once there is nothing left to wait on.
+// Failed jobs are reported here and no new jobs are launched after one.
+bool cbjob_pool_wait(cbjob_pool_t *pool, cbjob_t **job, proc_status_t *status);
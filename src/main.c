@@ -7,7 +7,10 @@
 
 #include <stdio.h>
 
+// The microbenchmarks have their own main
+#ifndef CB_MICROBENCH
 int main(int argc, char **argv) {
     printf("[INFO] CBuild version 0.0.3\n");
     return cb_main(argc, argv);
 }
+#endif /* CB_MICROBENCH */
@@ -10,59 +10,142 @@
 #include <stdbool.h>
 #include <stdio.h>
 
+#ifdef UNIX
+#include <pthread.h>
+
+// The directory walker allocates from several threads at once
+static pthread_mutex_t alloc_lock = PTHREAD_MUTEX_INITIALIZER;
+#define LOCK() pthread_mutex_lock(&alloc_lock)
+#define UNLOCK() pthread_mutex_unlock(&alloc_lock)
+#endif /* UNIX */
+
+#ifdef _WIN32
+// Nothing allocates from more than one thread on windows
+#define LOCK()
+#define UNLOCK()
+#endif /* _WIN32 */
+
 typedef struct alloc {
+    // NULL marks an empty slot
     void *ptr;
     const char* file;
     size_t line;
+    // Freed allocations stay behind as tombstones so a double free can still
+    // say where the memory came from, they are dropped when the table grows
     bool freed;
 } alloc_t;
 
-typedef struct alloc_list {
-    alloc_t *allocs;
-    size_t len;
+// Open-addressing table keyed by pointer
+typedef struct alloc_table {
+    alloc_t *slots;
+    // Always a power of two
     size_t capacity;
-} alloc_list_t;
+    // Allocations that haven't been freed
+    size_t live;
+    // Live allocations plus tombstones
+    size_t used;
+} alloc_table_t;
 
-static alloc_list_t alloc_list;
+static alloc_table_t alloc_table;
 static size_t total_allocs = 0;
 static size_t expensive_reallocs = 0;
 
-static alloc_list_t alloc_list_init(size_t capacity) {
-    alloc_list_t list;
-    list.allocs = (alloc_t*)CBMALLOC(capacity * sizeof(alloc_t));
-    list.len = 0;
-    list.capacity = capacity;
-    return list;
+static size_t alloc_hash(void *ptr, size_t capacity) {
+    // Allocations are at least 16 byte aligned so the low bits say nothing
+    return (size_t)((((uintptr_t)ptr >> 4) * 0x9E3779B97F4A7C15ULL) >> 16) & (capacity - 1);
 }
 
-static void alloc_list_push(alloc_list_t *list, alloc_t alloc) {
-    if (list->len == list->capacity) {
-        list->capacity = (list->capacity << 1) - (list->capacity >> 1);
-        list->allocs = (alloc_t*)CBREALLOC(list->allocs, list->capacity * sizeof(alloc_t));
+static void alloc_table_init(alloc_table_t *table, size_t capacity) {
+    table->slots = (alloc_t*)CBMALLOC(capacity * sizeof(alloc_t));
+    memset(table->slots, 0, capacity * sizeof(alloc_t));
+    table->capacity = capacity;
+    table->live = 0;
+    table->used = 0;
+}
+
+// Returns the slot holding `ptr`, or NULL if it isn't in the table
+static alloc_t *alloc_table_search(alloc_table_t *table, void *ptr) {
+    size_t i;
+
+    if (table->capacity == 0) {
+        return NULL;
+    }
+
+    for (i = alloc_hash(ptr, table->capacity); table->slots[i].ptr != NULL; i = (i + 1) & (table->capacity - 1)) {
+        if (table->slots[i].ptr == ptr) {
+            return &table->slots[i];
+        }
     }
 
-    list->allocs[list->len] = alloc;
-    ++list->len;
+    return NULL;
 }
 
-static alloc_t* alloc_list_search(alloc_list_t *list, void *ptr) {
+// Rebuilds the table with only the live allocations
+static void alloc_table_grow(alloc_table_t *table) {
+    alloc_table_t grown;
+    size_t capacity = table->capacity == 0 ? 64 : table->capacity;
     size_t i;
 
-    for (i = 0; i < list->len; ++i) {
-        if (list->allocs[i].ptr == ptr) {
-            break;
-        }
+    while (capacity < table->live * 4) {
+        capacity <<= 1;
     }
 
-    if (i == list->len) {
-        return NULL;
+    alloc_table_init(&grown, capacity);
+
+    for (i = 0; i < table->capacity; ++i) {
+        alloc_t *alloc = &table->slots[i];
+        size_t j;
+
+        if (alloc->ptr == NULL || alloc->freed) continue;
+
+        for (j = alloc_hash(alloc->ptr, capacity); grown.slots[j].ptr != NULL; j = (j + 1) & (capacity - 1));
+        grown.slots[j] = *alloc;
+        ++grown.live;
+        ++grown.used;
     }
 
-    return &list->allocs[i];
+    if (table->capacity != 0) {
+        CBFREE(table->slots);
+    }
+
+    *table = grown;
+}
+
+static void alloc_table_insert(alloc_table_t *table, void *ptr, const char *file, size_t line) {
+    alloc_t *alloc = alloc_table_search(table, ptr);
+    size_t i;
+
+    // The address was used before, its tombstone gets brought back
+    if (alloc != NULL) {
+        if (alloc->freed) ++table->live;
+        alloc->freed = false;
+        alloc->file = file;
+        alloc->line = line;
+        return;
+    }
+
+    if ((table->used + 1) * 4 > table->capacity * 3) {
+        alloc_table_grow(table);
+    }
+
+    for (i = alloc_hash(ptr, table->capacity); table->slots[i].ptr != NULL; i = (i + 1) & (table->capacity - 1));
+
+    alloc = &table->slots[i];
+    alloc->ptr = ptr;
+    alloc->file = file;
+    alloc->line = line;
+    alloc->freed = false;
+    ++table->live;
+    ++table->used;
+}
+
+static void alloc_table_remove(alloc_t *alloc) {
+    alloc->freed = true;
+    --alloc_table.live;
 }
 
 void debug_init() {
-    alloc_list = alloc_list_init(16);
+    alloc_table_init(&alloc_table, 64);
     printf("[DEBUG] cbmem debug init\n");
 }
 
@@ -70,9 +153,9 @@ void debug_deinit() {
     size_t i;
 
     printf("[DEBUG] cbmem debug deinit\n");
-    for (i = 0; i < alloc_list.len; ++i) {
-        alloc_t *alloc = &alloc_list.allocs[i];
-        if (!alloc->freed) {
+    for (i = 0; i < alloc_table.capacity; ++i) {
+        alloc_t *alloc = &alloc_table.slots[i];
+        if (alloc->ptr != NULL && !alloc->freed) {
             #ifdef _WIN32
             printf("[LEAK] %p leaked, alloc from %s:%I64d!\n", alloc->ptr, alloc->file, alloc->line);
             #endif
@@ -90,38 +173,44 @@ void debug_deinit() {
     printf("[DEBUG] %lu total allocs\n", total_allocs);
     printf("[DEBUG] %lu expensive reallocs\n", expensive_reallocs);
     #endif
+
+    if (alloc_table.capacity != 0) {
+        CBFREE(alloc_table.slots);
+    }
+    alloc_table.capacity = 0;
 }
 
 void *debug_alloc(size_t size, const char* file, size_t line) {
-    alloc_t alloc;
-    alloc_t *in_list;
     void *ptr;
 
-    ptr = malloc(size);
-    alloc.ptr = ptr;
-    alloc.file = file;
-    alloc.line = line;
-    alloc.freed = false;
-
-    in_list = alloc_list_search(&alloc_list, ptr);
-
-    if (!in_list) {
-        alloc_list_push(&alloc_list, alloc);
-    } else {
-        in_list->freed = false;
-        in_list->line = line;
-        in_list->file = file;
-    }
+    LOCK();
+    ptr = CBMALLOC(size);
+    alloc_table_insert(&alloc_table, ptr, file, line);
     ++total_allocs;
+    UNLOCK();
 
     return ptr;
 }
 
 void debug_free(void *ptr, const char *file, size_t line) {
     alloc_t *alloc;
-    alloc = alloc_list_search(&alloc_list, ptr);
-    
-    if (alloc->freed) {
+
+    if (ptr == NULL) {
+        return;
+    }
+
+    LOCK();
+    alloc = alloc_table_search(&alloc_table, ptr);
+
+    if (alloc == NULL) {
+        // The tombstone was already dropped, or it never came from here
+        #ifdef _WIN32
+        printf("[DFREE] %p double freed at %s:%I64d, alloc from an unknown location!\n", ptr, file, line);
+        #endif
+        #ifdef UNIX
+        printf("[DFREE] %p double freed at %s:%lu, alloc from an unknown location!\n", ptr, file, line);
+        #endif
+    } else if (alloc->freed) {
         #ifdef _WIN32
         printf("[DFREE] %p double freed at %s:%I64d, alloc from %s:%I64d!\n", ptr, file, line, alloc->file, alloc->line);
         #endif
@@ -130,39 +219,158 @@ void debug_free(void *ptr, const char *file, size_t line) {
         #endif
     } else {
         CBFREE(alloc->ptr);
-        alloc->freed = true;
+        alloc_table_remove(alloc);
     }
+    UNLOCK();
 }
 
 void *debug_realloc(void *ptr, size_t size) {
     void *new_ptr;
-    alloc_t *in_list;
-    alloc_t alloc;
+    alloc_t *old_alloc;
+    const char *file = "<realloc>";
+    size_t line = 0;
+
+    LOCK();
+    // Looked up first, the old pointer can't be touched once realloc moves it
+    old_alloc = alloc_table_search(&alloc_table, ptr);
+
+    if (old_alloc != NULL) {
+        file = old_alloc->file;
+        line = old_alloc->line;
+    }
 
     new_ptr = CBREALLOC(ptr, size);
 
     if (new_ptr != ptr) {
-        alloc_t *old_alloc;
         ++expensive_reallocs;
-        old_alloc = alloc_list_search(&alloc_list, ptr);
-        old_alloc->freed = true;
-
-        alloc.ptr = new_ptr;
-        alloc.file = old_alloc->file;
-        alloc.line = old_alloc->line;
-        alloc.freed = false;
-
-        in_list = alloc_list_search(&alloc_list, new_ptr);
-
-        if (!in_list) {
-            alloc_list_push(&alloc_list, alloc);
-        } else {
-            in_list->freed = false;
-            in_list->line = alloc.line;
-            in_list->file = alloc.file;
+
+        if (old_alloc != NULL) {
+            alloc_table_remove(old_alloc);
         }
+
+        alloc_table_insert(&alloc_table, new_ptr, file, line);
     }
+    UNLOCK();
 
+    return new_ptr;
+}
+
+void *counted_alloc(size_t size) {
+    ++total_allocs;
+    return CBMALLOC(size);
+}
+
+void *counted_realloc(void *ptr, size_t size) {
+    void *new_ptr = CBREALLOC(ptr, size);
+
+    if (new_ptr != ptr) {
+        ++expensive_reallocs;
+    }
 
     return new_ptr;
 }
+
+void cbmem_counters(size_t *allocs, size_t *reallocs) {
+    *allocs = total_allocs;
+    *reallocs = expensive_reallocs;
+}
+
+// Blocks are aligned for anything a dir_entry_t or tt_entry_t holds
+#define ARENA_ALIGN(s) (((s) + 7) & ~(size_t)7)
+#define ARENA_HEADER ARENA_ALIGN(sizeof(cbarena_block_t))
+// Each new block is twice as big as the last up to this
+#define ARENA_MAX_BLOCK (4 * 1024 * 1024)
+
+static cbarena_block_t *arena_block(cbarena_t *arena, size_t size) {
+    cbarena_block_t *block;
+
+    #ifndef RELEASE
+    block = WMALLOC(ARENA_HEADER + size, arena->file, arena->line);
+    #else
+    block = MALLOC(ARENA_HEADER + size);
+    #endif /* RELEASE */
+
+    block->next = NULL;
+    block->used = 0;
+    block->size = size;
+    return block;
+}
+
+cbarena_t ALLOC_DEF(cbarena_init, size_t block_size) {
+    cbarena_t arena;
+
+    arena.head = NULL;
+    arena.block_size = block_size;
+
+    #ifndef RELEASE
+    arena.file = file;
+    arena.line = line;
+    #endif /* RELEASE */
+
+    return arena;
+}
+
+void ALLOC_DEF(cbarena_free, cbarena_t *arena) {
+    cbarena_block_t *block = arena->head;
+
+    while (block != NULL) {
+        cbarena_block_t *next = block->next;
+        FFREE(block);
+        block = next;
+    }
+
+    arena->head = NULL;
+}
+
+void *cbarena_alloc(cbarena_t *arena, size_t size) {
+    cbarena_block_t *block = arena->head;
+    void *ptr;
+
+    size = ARENA_ALIGN(size);
+
+    if (block == NULL || block->size - block->used < size) {
+        // Big allocations get their own block behind the current one so
+        // the rest of the current block isn't wasted
+        if (block != NULL && size > (arena->block_size >> 2)) {
+            cbarena_block_t *big = arena_block(arena, size);
+            big->next = block->next;
+            block->next = big;
+            big->used = size;
+            return (char*)big + ARENA_HEADER;
+        }
+
+        block = arena_block(arena, size > arena->block_size ? size : arena->block_size);
+        block->next = arena->head;
+        arena->head = block;
+
+        if (arena->block_size < ARENA_MAX_BLOCK) {
+            arena->block_size <<= 1;
+        }
+    }
+
+    ptr = (char*)block + ARENA_HEADER + block->used;
+    block->used += size;
+    return ptr;
+}
+
+void cbarena_adopt(cbarena_t *dst, cbarena_t *src) {
+    cbarena_block_t *tail = src->head;
+
+    if (tail == NULL) {
+        return;
+    }
+
+    while (tail->next != NULL) {
+        tail = tail->next;
+    }
+
+    // Keeps the destination's current block at the front
+    if (dst->head == NULL) {
+        dst->head = src->head;
+    } else {
+        tail->next = dst->head->next;
+        dst->head->next = src->head;
+    }
+
+    src->head = NULL;
+}
@@ -45,11 +45,17 @@
 #else
 
 #define ALLOC_DEF(fn, ...) d_ ## fn(__VA_ARGS__)
+#ifdef CB_MICROBENCH
+// Only counted, the microbenchmarks report allocations without paying for
+// the debug tracking
+#define MALLOC(s) counted_alloc(s)
+#else
 #define MALLOC(s) CBMALLOC(s)
+#endif /* CB_MICROBENCH */
 #define FREE(p) CBFREE(p)
 
 #define WMALLOC(s, f, l) MALLOC(s)
-#define WFREE(p, f, l) FREE(s)
+#define WFREE(p, f, l) FREE(p)
 
 #define FMALLOC(len) MALLOC(len)
 #define FFREE(ptr) FREE(ptr)
@@ -57,7 +63,11 @@
 #define FORWARD(call, ...) d_ ## call(__VA_ARGS__)
 
 
+#ifdef CB_MICROBENCH
+#define REALLOC(p, s) counted_realloc(p, s)
+#else
 #define REALLOC(p, s) CBREALLOC(p, s)
+#endif /* CB_MICROBENCH */
 
 #define DEBUG_INIT()
 #define DEBUG_DEINIT()
@@ -69,3 +79,42 @@ void debug_deinit();
 void *debug_alloc(size_t size, const char* file, size_t line);
 void debug_free(void *ptr, const char *file, size_t line);
 void *debug_realloc(void *ptr, size_t size);
+void *counted_alloc(size_t size);
+void *counted_realloc(void *ptr, size_t size);
+// Allocations and reallocs that moved since the program started, only
+// counted by the debug allocator and in CB_MICROBENCH builds.
+void cbmem_counters(size_t *allocs, size_t *reallocs);
+
+// Bump allocator for things that all live as long as each other. Nothing is
+// freed on its own, every block goes at once in cbarena_free. Debug builds
+// track each block as one allocation from wherever the arena was created.
+typedef struct cbarena_block {
+    struct cbarena_block *next;
+    size_t used;
+    size_t size;
+} cbarena_block_t;
+
+typedef struct cbarena {
+    cbarena_block_t *head;
+    // Size of the next block, doubles every time one is added
+    size_t block_size;
+
+    #ifndef RELEASE
+    const char *file;
+    size_t line;
+    #endif /* RELEASE */
+} cbarena_t;
+
+#ifndef RELEASE
+#define cbarena_init(block_size) d_cbarena_init(block_size, __FILE__, __LINE__)
+#define cbarena_free(arena) d_cbarena_free(arena, __FILE__, __LINE__)
+#else
+#define cbarena_init(block_size) d_cbarena_init(block_size)
+#define cbarena_free(arena) d_cbarena_free(arena)
+#endif /* RELEASE */
+
+cbarena_t ALLOC_DEF(cbarena_init, size_t block_size);
+void ALLOC_DEF(cbarena_free, cbarena_t *arena);
+void *cbarena_alloc(cbarena_t *arena, size_t size);
+// Moves every block of `src` into `dst`, leaving `src` empty.
+void cbarena_adopt(cbarena_t *dst, cbarena_t *src);
@@ -17,6 +17,9 @@
 #include <dirent.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <errno.h>
 
 #define PATH_SEP '/'
@@ -26,17 +29,37 @@
 
 #include "../mem/cbmem.h"
 #include "../util/cbstr.h"
+#include "time.h"
+
+#define DIR_ARENA_BLOCK (64 * 1024)
 
 dir_t dir_init() {
     dir_t dir;
     dir.dir_names = cbstr_list_init(4);
     dir.entries = entry_list_init(4);
+    dir.arena = cbarena_init(DIR_ARENA_BLOCK);
     return dir;
 }
 
 void dir_free(dir_t *dir) {
     cbstr_list_free(&dir->dir_names);
     entry_list_free(&dir->entries);
+    cbarena_free(&dir->arena);
+}
+
+// `name_len` includes the terminator
+static cbstr_t join_path(cbarena_t *arena, cbstr_t *parent, const char *name, size_t name_len) {
+    cbstr_t path;
+
+    // The parent's terminator becomes the separator
+    path.len = parent->len + name_len;
+    path.capacity = 0;
+    path.data = cbarena_alloc(arena, path.len);
+    memcpy(path.data, parent->data, parent->len - 1);
+    path.data[parent->len - 1] = PATH_SEP;
+    memcpy(path.data + parent->len, name, name_len);
+
+    return path;
 }
 
 // TODO: make all of this code platform agnostic
@@ -67,15 +90,15 @@ void walk_dir_windows(dir_t *dir, cbstr_t path) {
             if (find.cFileName[0] == '.' && (find.cFileName[1] == 0 || (find.cFileName[1] == '.' && find.cFileName[2] == 0))) {
                 continue;
             }
-            new_path = cbstr_copy(cbstr_list_get(&dir->dir_names, name_index));
-            cbstr_concat_cstr(&new_path, "\\", 2);
-            cbstr_concat_cstr(&new_path, find.cFileName, strnlen(find.cFileName, 260)+1);
+            new_path = join_path(&dir->arena, cbstr_list_get(&dir->dir_names, name_index), find.cFileName, strnlen(find.cFileName, 260)+1);
             walk_dir_windows(dir, new_path);
         } else {
             dir_entry_t entry;
             entry.parent = name_index;
-            entry.filename = cbstr_from_cstr(find.cFileName, strnlen(find.cFileName, 260)+1);
+            entry.filename = cbstr_arena_from_cstr(&dir->arena, find.cFileName, strnlen(find.cFileName, 260)+1);
             entry.write_time = (int64_t)(find.ftLastWriteTime.dwLowDateTime) | ((int64_t)(find.ftLastWriteTime.dwHighDateTime) << 32);
+            entry.size = (uint64_t)(find.nFileSizeLow) | ((uint64_t)(find.nFileSizeHigh) << 32);
+            entry.hash = 0;
             entry_list_push(&dir->entries, entry);
         }
     } while (FindNextFileA(walk_handle, &find));
@@ -88,80 +111,295 @@ void walk_dir_windows(dir_t *dir, cbstr_t path) {
 
 #ifdef UNIX
 
-void walk_dir_linux(dir_t *dir, cbstr_t path) {
-    cbstr_t root;
+static int64_t stat_write_time(struct stat *statbuf) {
+    #ifdef __linux__
+    return statbuf->st_mtim.tv_sec * NS_PER_SECOND + statbuf->st_mtim.tv_nsec;
+    #endif /* __linux__ */
+    #ifdef __APPLE__
+    return statbuf->st_mtimespec.tv_sec * NS_PER_SECOND + statbuf->st_mtimespec.tv_nsec;
+    #endif /* __APPLE__ */
+}
 
-    size_t name_index;
+static bool is_dot_dir(const char *name) {
+    return name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0));
+}
+
+// Walks the directory open as `fd`, which is already in the name table at
+// `name_index`. Everything is looked up relative to the directory fd so no
+// paths are built except for directories. Takes ownership of `fd`.
+static void walk_dir_fd(dir_t *dir, int fd, size_t name_index) {
     DIR *dir_handle;
     struct dirent *dirent;
 
-    cbstr_list_push(&dir->dir_names, path);
-    name_index = dir->dir_names.len - 1;
-    root = cbstr_copy(&path);
-
-    dir_handle = opendir(root.data);
+    dir_handle = fdopendir(fd);
 
     if (dir_handle == NULL) {
-        cbstr_free(&root);
+        close(fd);
         return;
     }
 
     while ((dirent = readdir(dir_handle))) {
         struct stat statbuf;
-        // Will go into dir name table and be freed later or get freed if not a dir
-        cbstr_t full_path;
+        unsigned char type = dirent->d_type;
 
-        full_path = cbstr_copy(cbstr_list_get(&dir->dir_names, name_index));
-        cbstr_concat_cstr(&full_path, "/", 2);
-        cbstr_concat_cstr(&full_path, dirent->d_name, strnlen(dirent->d_name, 256)+1);
+        if (is_dot_dir(dirent->d_name)) {
+            continue;
+        }
 
-        lstat(dirent->d_name, &statbuf);
+        // Some filesystems don't fill in d_type
+        if (type == DT_REG || type == DT_UNKNOWN) {
+            if (fstatat(fd, dirent->d_name, &statbuf, AT_SYMLINK_NOFOLLOW) != 0) {
+                continue;
+            }
 
+            type = S_ISREG(statbuf.st_mode) ? DT_REG : S_ISDIR(statbuf.st_mode) ? DT_DIR : DT_UNKNOWN;
+        }
 
-        if (dirent->d_type == DT_REG) {
+        if (type == DT_REG) {
             dir_entry_t entry;
             entry.parent = name_index;
-            entry.filename = cbstr_from_cstr(dirent->d_name, strnlen(dirent->d_name, 256)+1);
-            #ifdef __linux__
-            entry.write_time = statbuf.st_mtim.tv_sec;
-            #endif /* __linux__ */
-            #ifdef __APPLE__
-            entry.write_time = statbuf.st_mtimespec.tv_sec;
-            #endif /* __APPLE__ */
+            entry.filename = cbstr_arena_from_cstr(&dir->arena, dirent->d_name, strnlen(dirent->d_name, 256)+1);
+            entry.write_time = stat_write_time(&statbuf);
+            entry.size = statbuf.st_size;
+            entry.hash = 0;
             entry_list_push(&dir->entries, entry);
-            cbstr_free(&full_path);
-        } else if (dirent->d_type == DT_DIR) {
-            if (dirent->d_name[0] == '.' && (dirent->d_name[1] == 0 || (dirent->d_name[1] == '.' && dirent->d_name[2] == 0))) {
-                cbstr_free(&full_path);
+        } else if (type == DT_DIR) {
+            int child = openat(fd, dirent->d_name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+
+            if (child < 0) {
                 continue;
             }
-            walk_dir_linux(dir, full_path);
+
+            cbstr_list_push(&dir->dir_names, join_path(&dir->arena, cbstr_list_get(&dir->dir_names, name_index), dirent->d_name, strnlen(dirent->d_name, 256)+1));
+            walk_dir_fd(dir, child, dir->dir_names.len - 1);
         }
     }
 
     closedir(dir_handle);
-    cbstr_free(&root);
+}
+
+// A subdirectory of the root walked by one of the walker threads
+typedef struct walk_task {
+    dir_t result;
+} walk_task_t;
+
+typedef struct walk_pool {
+    walk_task_t *tasks;
+    size_t len;
+    size_t next;
+    int root;
+    size_t root_len;
+    pthread_mutex_t lock;
+} walk_pool_t;
+
+static void *walk_worker(void *arg) {
+    walk_pool_t *pool = arg;
+    walk_task_t *task;
+    const char *name;
+    int fd;
+
+    for (;;) {
+        pthread_mutex_lock(&pool->lock);
+        task = pool->next < pool->len ? &pool->tasks[pool->next++] : NULL;
+        pthread_mutex_unlock(&pool->lock);
+
+        if (task == NULL) {
+            return NULL;
+        }
+
+        // The task's only directory name so far is its own path
+        name = task->result.dir_names.strings[0].data + pool->root_len;
+        fd = openat(pool->root, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+
+        if (fd >= 0) {
+            walk_dir_fd(&task->result, fd, 0);
+        }
+    }
+}
+
+// Walks every subdirectory of the root on its own thread and merges the
+// results in the order the subdirectories were found, so the output doesn't
+// depend on which thread finished first.
+static void walk_dir_threaded(dir_t *dir, int fd, size_t threads) {
+    DIR *dir_handle;
+    struct dirent *dirent;
+    walk_pool_t pool;
+    pthread_t *workers;
+    size_t started;
+    size_t cap = 16;
+    size_t i;
+    size_t j;
+
+    dir_handle = fdopendir(fd);
+
+    if (dir_handle == NULL) {
+        close(fd);
+        return;
+    }
+
+    pool.tasks = MALLOC(cap * sizeof(walk_task_t));
+    pool.len = 0;
+    pool.next = 0;
+    pool.root = fd;
+    pool.root_len = dir->dir_names.strings[0].len;
+    pthread_mutex_init(&pool.lock, NULL);
+
+    // Files in the root are handled here, directories are queued up
+    while ((dirent = readdir(dir_handle))) {
+        struct stat statbuf;
+        unsigned char type = dirent->d_type;
+
+        if (is_dot_dir(dirent->d_name)) {
+            continue;
+        }
+
+        if (type == DT_REG || type == DT_UNKNOWN) {
+            if (fstatat(fd, dirent->d_name, &statbuf, AT_SYMLINK_NOFOLLOW) != 0) {
+                continue;
+            }
+
+            type = S_ISREG(statbuf.st_mode) ? DT_REG : S_ISDIR(statbuf.st_mode) ? DT_DIR : DT_UNKNOWN;
+        }
+
+        if (type == DT_REG) {
+            dir_entry_t entry;
+            entry.parent = 0;
+            entry.filename = cbstr_arena_from_cstr(&dir->arena, dirent->d_name, strnlen(dirent->d_name, 256)+1);
+            entry.write_time = stat_write_time(&statbuf);
+            entry.size = statbuf.st_size;
+            entry.hash = 0;
+            entry_list_push(&dir->entries, entry);
+        } else if (type == DT_DIR) {
+            walk_task_t *task;
+
+            if (pool.len == cap) {
+                cap <<= 1;
+                pool.tasks = REALLOC(pool.tasks, cap * sizeof(walk_task_t));
+            }
+
+            task = &pool.tasks[pool.len];
+            task->result = dir_init();
+            cbstr_list_push(&task->result.dir_names, join_path(&task->result.arena, cbstr_list_get(&dir->dir_names, 0), dirent->d_name, strnlen(dirent->d_name, 256)+1));
+            ++pool.len;
+        }
+    }
+
+    if (threads > pool.len) {
+        threads = pool.len;
+    }
+
+    workers = MALLOC((threads + 1) * sizeof(pthread_t));
+
+    for (started = 0; started < threads; ++started) {
+        if (pthread_create(&workers[started], NULL, walk_worker, &pool) != 0) {
+            break;
+        }
+    }
+
+    // Walk on this thread too, which also covers threads failing to start
+    walk_worker(&pool);
+
+    for (i = 0; i < started; ++i) {
+        pthread_join(workers[i], NULL);
+    }
+
+    for (i = 0; i < pool.len; ++i) {
+        dir_t *result = &pool.tasks[i].result;
+        size_t base = dir->dir_names.len;
+
+        for (j = 0; j < result->dir_names.len; ++j) {
+            cbstr_list_push(&dir->dir_names, result->dir_names.strings[j]);
+        }
+
+        for (j = 0; j < result->entries.len; ++j) {
+            result->entries.entries[j].parent += base;
+            entry_list_push(&dir->entries, result->entries.entries[j]);
+        }
+
+        // The strings were moved over, only the arrays are left to free
+        cbarena_adopt(&dir->arena, &result->arena);
+        result->dir_names.len = 0;
+        result->entries.len = 0;
+        dir_free(result);
+    }
+
+    pthread_mutex_destroy(&pool.lock);
+    FREE(workers);
+    FREE(pool.tasks);
+    closedir(dir_handle);
 }
 
 #endif /* UNIX */
 
-dir_t walk_dir(cbstr_t path) {
+dir_t walk_dir(cbstr_t path, size_t threads) {
     dir_t dir = dir_init();
 
-    // Will go into dir name table and be freed later
-    cbstr_t root = cbstr_copy(&path);
+    cbstr_t root = cbstr_arena_copy(&dir.arena, &path);
 
     #ifdef _WIN32
     walk_dir_windows(&dir, root);
     #endif
 
     #ifdef UNIX
-    walk_dir_linux(&dir, root);
+    int fd;
+
+    cbstr_list_push(&dir.dir_names, root);
+    fd = open(root.data, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if (fd < 0) {
+        return dir;
+    }
+
+    if (threads > 1) {
+        walk_dir_threaded(&dir, fd, threads - 1);
+    } else {
+        walk_dir_fd(&dir, fd, 0);
+    }
     #endif
 
     return dir;
 }
 
+void dir_refresh_file(dir_t *dir, size_t parent, cbstr_t *name) {
+    cbstr_t path;
+    dir_entry_t *entry = NULL;
+    int64_t write_time;
+    uint64_t size;
+    bool exists;
+    size_t i;
+
+    for (i = 0; i < dir->entries.len; ++i) {
+        if (dir->entries.entries[i].parent == parent && cbstr_cmp(&dir->entries.entries[i].filename, name)) {
+            entry = &dir->entries.entries[i];
+            break;
+        }
+    }
+
+    path = cbstr_copy(cbstr_list_get(&dir->dir_names, parent));
+    cbstr_concat_cstr(&path, PATH_SEP_WIDE, 2);
+    cbstr_concat(&path, name);
+    exists = file_stat(path.data, &write_time, &size);
+    cbstr_free(&path);
+
+    if (exists && entry != NULL) {
+        entry->write_time = write_time;
+        entry->size = size;
+    } else if (exists) {
+        dir_entry_t new_entry;
+        new_entry.parent = parent;
+        new_entry.filename = cbstr_arena_copy(&dir->arena, name);
+        new_entry.write_time = write_time;
+        new_entry.size = size;
+        new_entry.hash = 0;
+        entry_list_push(&dir->entries, new_entry);
+    } else if (entry != NULL) {
+        // Order doesn't matter so the last entry is moved into the gap, the
+        // name stays in the arena until the tree is freed
+        --dir->entries.len;
+        *entry = dir->entries.entries[dir->entries.len];
+    }
+}
+
 entry_list_t entry_list_init(size_t cap) {
     entry_list_t list = {.cap = cap, .len = 0, .entries = MALLOC(cap * sizeof(dir_entry_t))};
     return list;
@@ -183,9 +421,7 @@ dir_entry_t* entry_list_get(entry_list_t *list, size_t item) {
 }
 
 void entry_list_free(entry_list_t *list) {
-    for (size_t i = 0; i < list->len; ++i) {
-        cbstr_free(&list->entries[i].filename);
-    }
+    // Filenames belong to the dir_t's arena
     FREE(list->entries);
 }
 
@@ -247,3 +483,104 @@ bool file_exists(const char *path) {
     return (stat(path, &buffer) == 0);
     #endif /* UNIX */
 }
+
+bool file_stat(const char *path, int64_t *write_time, uint64_t *size) {
+    #ifdef _WIN32
+    WIN32_FILE_ATTRIBUTE_DATA data;
+
+    if (!GetFileAttributesExA(path, GetFileExInfoStandard, &data)) {
+        return false;
+    }
+
+    *write_time = (int64_t)(data.ftLastWriteTime.dwLowDateTime) | ((int64_t)(data.ftLastWriteTime.dwHighDateTime) << 32);
+    *size = (uint64_t)(data.nFileSizeLow) | ((uint64_t)(data.nFileSizeHigh) << 32);
+    return true;
+    #endif /* _WIN32 */
+
+    #ifdef UNIX
+    struct stat buffer;
+
+    if (stat(path, &buffer) != 0) {
+        return false;
+    }
+
+    *write_time = stat_write_time(&buffer);
+    *size = buffer.st_size;
+    return true;
+    #endif /* UNIX */
+}
+
+bool file_link(const char *from, const char *to) {
+    #ifdef _WIN32
+    DeleteFileA(to);
+
+    if (CreateHardLinkA(to, from, NULL)) {
+        return true;
+    }
+
+    return CopyFileA(from, to, FALSE) != 0;
+    #endif /* _WIN32 */
+
+    #ifdef UNIX
+    char buffer[64 * 1024];
+    ssize_t len;
+    int in;
+    int out;
+
+    unlink(to);
+
+    if (link(from, to) == 0) {
+        return true;
+    }
+
+    // Most likely on another file system
+    in = open(from, O_RDONLY | O_CLOEXEC);
+
+    if (in < 0) {
+        return false;
+    }
+
+    out = open(to, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if (out < 0) {
+        close(in);
+        return false;
+    }
+
+    while ((len = read(in, buffer, sizeof(buffer))) > 0) {
+        if (write(out, buffer, len) != len) {
+            len = -1;
+            break;
+        }
+    }
+
+    close(in);
+    close(out);
+
+    if (len < 0) {
+        unlink(to);
+        return false;
+    }
+
+    return true;
+    #endif /* UNIX */
+}
+
+void file_touch(const char *path) {
+    #ifdef _WIN32
+    FILETIME now;
+    HANDLE file = CreateFileA(path, FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if (file == INVALID_HANDLE_VALUE) {
+        return;
+    }
+
+    GetSystemTimeAsFileTime(&now);
+    SetFileTime(file, NULL, NULL, &now);
+    CloseHandle(file);
+    #endif /* _WIN32 */
+
+    #ifdef UNIX
+    utimensat(AT_FDCWD, path, NULL, 0);
+    #endif /* UNIX */
+}
@@ -11,7 +11,11 @@
 typedef struct dir_entry {
     size_t parent;
     cbstr_t filename;
-    time_t write_time;
+    // Nanoseconds since the epoch on unix, FILETIME ticks on windows
+    int64_t write_time;
+    uint64_t size;
+    // Content hash, only filled in for files that get compiled
+    uint64_t hash;
 } dir_entry_t;
 
 typedef struct entry_list {
@@ -23,10 +27,17 @@ typedef struct entry_list {
 typedef struct dir {
     entry_list_t entries;
     cbstr_list_t dir_names;
+    // Every file and directory name lives here and is freed with the tree
+    cbarena_t arena;
 } dir_t;
 
-dir_t walk_dir(cbstr_t path);
+// Subdirectories of `path` are walked on up to `threads` threads at once,
+// only the calling thread is used if it is 1 or on windows.
+dir_t walk_dir(cbstr_t path, size_t threads);
 void dir_free(dir_t *dir);
+// Stats a single file again after it changed, adding or removing its entry
+// if it was created or deleted.
+void dir_refresh_file(dir_t *dir, size_t parent, cbstr_t *name);
 
 entry_list_t entry_list_init(size_t cap);
 void entry_list_push(entry_list_t *list, dir_entry_t entry);
@@ -35,5 +46,12 @@ void entry_list_free(entry_list_t *list);
 
 void create_dir(char *path);
 bool file_exists(const char *path);
+// Returns false if the file could not be found.
+bool file_stat(const char *path, int64_t *write_time, uint64_t *size);
+// Replaces `to` with a hard link to `from`, or a copy of it where the two
+// can't be linked.
+bool file_link(const char *from, const char *to);
+// Sets the write time of a file to now.
+void file_touch(const char *path);
 
 // TODO: add api for creating directories and checking if files exist
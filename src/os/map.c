@@ -0,0 +1,109 @@
+/// Author - zebubull
+/// map.c
+/// map.h implementation
+/// Copyright (c) zebubull 2023
+#include "map.h"
+
+#ifdef UNIX
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif /* UNIX */
+
+#ifdef _WIN32
+
+bool file_map(const char *path, file_map_t *map) {
+    LARGE_INTEGER size;
+
+    map->data = NULL;
+    map->size = 0;
+    map->mapping = NULL;
+    map->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if (map->file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+
+    if (!GetFileSizeEx(map->file, &size) || size.QuadPart == 0) {
+        CloseHandle(map->file);
+        return false;
+    }
+
+    map->mapping = CreateFileMappingA(map->file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
+
+    if (map->mapping == NULL) {
+        CloseHandle(map->file);
+        return false;
+    }
+
+    map->data = MapViewOfFile(map->mapping, FILE_MAP_COPY, 0, 0, 0);
+
+    if (map->data == NULL) {
+        CloseHandle(map->mapping);
+        CloseHandle(map->file);
+        return false;
+    }
+
+    map->size = (size_t)size.QuadPart;
+    return true;
+}
+
+void file_unmap(file_map_t *map) {
+    if (map->data == NULL) {
+        return;
+    }
+
+    UnmapViewOfFile(map->data);
+    CloseHandle(map->mapping);
+    CloseHandle(map->file);
+    map->data = NULL;
+    map->size = 0;
+}
+
+#endif /* _WIN32 */
+
+#ifdef UNIX
+
+bool file_map(const char *path, file_map_t *map) {
+    int fd;
+    struct stat statbuf;
+
+    map->data = NULL;
+    map->size = 0;
+
+    fd = open(path, O_RDONLY);
+
+    if (fd < 0) {
+        return false;
+    }
+
+    if (fstat(fd, &statbuf) != 0 || statbuf.st_size == 0) {
+        close(fd);
+        return false;
+    }
+
+    map->data = mmap(NULL, statbuf.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    // The mapping keeps the file alive on its own
+    close(fd);
+
+    if (map->data == MAP_FAILED) {
+        map->data = NULL;
+        return false;
+    }
+
+    map->size = statbuf.st_size;
+    return true;
+}
+
+void file_unmap(file_map_t *map) {
+    if (map->data == NULL) {
+        return;
+    }
+
+    munmap(map->data, map->size);
+    map->data = NULL;
+    map->size = 0;
+}
+
+#endif /* UNIX */
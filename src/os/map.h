@@ -0,0 +1,29 @@
+/// Author - zebubull
+/// map.h
+/// A header for memory mapping files.
+/// Copyright (c) zebubull 2023
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "osdef.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif /* _WIN32 */
+
+typedef struct file_map {
+    void *data;
+    size_t size;
+
+    #ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+    #endif /* _WIN32 */
+} file_map_t;
+
+// Maps a whole file copy-on-write, writes to the mapping never reach the
+// file. Returns false if the file could not be opened or is empty.
+bool file_map(const char *path, file_map_t *map);
+void file_unmap(file_map_t *map);
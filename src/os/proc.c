@@ -0,0 +1,353 @@
+/// Author - zebubull
+/// proc.c
+/// proc.h implementation
+/// Copyright (c) zebubull 2023
+#include "proc.h"
+
+#include "../mem/cbmem.h"
+
+#ifdef UNIX
+#include <unistd.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern char **environ;
+#endif /* UNIX */
+
+#ifdef _WIN32
+
+// Quotes an argument the way CommandLineToArgvW and the C runtime split them.
+// Returns the position after the written argument.
+static size_t quote_arg(char *out, size_t pos, const char *arg) {
+    size_t slashes;
+
+    if (*arg != 0 && strpbrk(arg, " \t\"") == NULL) {
+        size_t len = strlen(arg);
+        memcpy(out + pos, arg, len);
+        return pos + len;
+    }
+
+    out[pos++] = '"';
+
+    for (;;) {
+        slashes = 0;
+        while (*arg == '\\') {
+            ++slashes;
+            ++arg;
+        }
+
+        if (*arg == 0) {
+            // Backslashes before the closing quote have to be doubled
+            slashes <<= 1;
+        } else if (*arg == '"') {
+            slashes = (slashes << 1) + 1;
+        }
+
+        while (slashes--) {
+            out[pos++] = '\\';
+        }
+
+        if (*arg == 0) break;
+        out[pos++] = *arg++;
+    }
+
+    out[pos++] = '"';
+    return pos;
+}
+
+bool proc_spawn(char **argv, proc_t *proc) {
+    STARTUPINFOA startup;
+    PROCESS_INFORMATION info;
+    char *command;
+    size_t size = 1;
+    size_t pos = 0;
+    size_t i;
+    BOOL created;
+
+    // Worst case every character is escaped and the argument quoted
+    for (i = 0; argv[i] != NULL; ++i) {
+        size += strlen(argv[i]) * 2 + 3;
+    }
+
+    command = MALLOC(size);
+
+    for (i = 0; argv[i] != NULL; ++i) {
+        if (i != 0) command[pos++] = ' ';
+        pos = quote_arg(command, pos, argv[i]);
+    }
+    command[pos] = 0;
+
+    ZeroMemory(&startup, sizeof(startup));
+    startup.cb = sizeof(startup);
+
+    created = CreateProcessA(NULL, command, NULL, NULL, TRUE, 0, NULL, NULL, &startup, &info);
+    FREE(command);
+
+    if (!created) {
+        return false;
+    }
+
+    CloseHandle(info.hThread);
+    *proc = info.hProcess;
+    return true;
+}
+
+bool proc_run(char **argv, cbstr_t *output, proc_status_t *status) {
+    SECURITY_ATTRIBUTES attributes;
+    STARTUPINFOA startup;
+    PROCESS_INFORMATION info;
+    HANDLE read_end;
+    HANDLE write_end;
+    char buffer[512];
+    char *command;
+    size_t size = 1;
+    size_t pos = 0;
+    size_t i;
+    DWORD len;
+    DWORD exit_code;
+    BOOL created;
+
+    attributes.nLength = sizeof(attributes);
+    attributes.lpSecurityDescriptor = NULL;
+    attributes.bInheritHandle = TRUE;
+
+    if (!CreatePipe(&read_end, &write_end, &attributes, 0)) {
+        return false;
+    }
+
+    // Only the child gets the write end
+    SetHandleInformation(read_end, HANDLE_FLAG_INHERIT, 0);
+
+    for (i = 0; argv[i] != NULL; ++i) {
+        size += strlen(argv[i]) * 2 + 3;
+    }
+
+    command = MALLOC(size);
+
+    for (i = 0; argv[i] != NULL; ++i) {
+        if (i != 0) command[pos++] = ' ';
+        pos = quote_arg(command, pos, argv[i]);
+    }
+    command[pos] = 0;
+
+    ZeroMemory(&startup, sizeof(startup));
+    startup.cb = sizeof(startup);
+    startup.dwFlags = STARTF_USESTDHANDLES;
+    startup.hStdInput = GetStdHandle(STD_INPUT_HANDLE);
+    startup.hStdOutput = write_end;
+    startup.hStdError = write_end;
+
+    created = CreateProcessA(NULL, command, NULL, NULL, TRUE, 0, NULL, NULL, &startup, &info);
+    FREE(command);
+    CloseHandle(write_end);
+
+    if (!created) {
+        CloseHandle(read_end);
+        return false;
+    }
+
+    cbstr_clear(output);
+    while (ReadFile(read_end, buffer, sizeof(buffer), &len, NULL) && len != 0) {
+        cbstr_concat_cstr(output, buffer, len);
+    }
+    CloseHandle(read_end);
+
+    WaitForSingleObject(info.hProcess, INFINITE);
+    GetExitCodeProcess(info.hProcess, &exit_code);
+    CloseHandle(info.hProcess);
+    CloseHandle(info.hThread);
+    status->code = (int)exit_code;
+    status->signal = 0;
+
+    return true;
+}
+
+size_t proc_wait_any(proc_t *procs, size_t len, proc_status_t *status) {
+    DWORD result;
+    DWORD exit_code;
+
+    result = WaitForMultipleObjects((DWORD)len, procs, FALSE, INFINITE);
+
+    if (result >= WAIT_OBJECT_0 + len) {
+        return len;
+    }
+
+    result -= WAIT_OBJECT_0;
+    GetExitCodeProcess(procs[result], &exit_code);
+    CloseHandle(procs[result]);
+    status->code = (int)exit_code;
+    status->signal = 0;
+
+    return result;
+}
+
+size_t proc_cpu_count() {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+}
+
+bool proc_find_program(const char *name, cbstr_t *path) {
+    char found[MAX_PATH];
+    DWORD len = SearchPathA(NULL, name, ".exe", MAX_PATH, found, NULL);
+
+    if (len == 0 || len >= MAX_PATH) {
+        return false;
+    }
+
+    cbstr_clear(path);
+    cbstr_concat_cstr(path, found, len);
+    return true;
+}
+
+#endif /* _WIN32 */
+
+#ifdef UNIX
+
+bool proc_spawn(char **argv, proc_t *proc) {
+    pid_t pid;
+
+    // Reports exec failures (e.g. the compiler isn't on the PATH) as an error
+    // instead of a child exiting with 127
+    if (posix_spawnp(&pid, argv[0], NULL, NULL, argv, environ) != 0) {
+        return false;
+    }
+
+    *proc = pid;
+    return true;
+}
+
+static void exit_status(int status, proc_status_t *result) {
+    result->signal = 0;
+
+    if (WIFEXITED(status)) {
+        result->code = WEXITSTATUS(status);
+    } else if (WIFSIGNALED(status)) {
+        result->signal = WTERMSIG(status);
+        result->code = 128 + result->signal;
+    } else {
+        result->code = -1;
+    }
+}
+
+bool proc_run(char **argv, cbstr_t *output, proc_status_t *result) {
+    posix_spawn_file_actions_t actions;
+    char buffer[512];
+    int fds[2];
+    pid_t pid;
+    ssize_t len;
+    int status;
+    int spawned;
+
+    if (pipe(fds) != 0) {
+        return false;
+    }
+
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], 1);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], 2);
+    posix_spawn_file_actions_addclose(&actions, fds[0]);
+    posix_spawn_file_actions_addclose(&actions, fds[1]);
+    spawned = posix_spawnp(&pid, argv[0], &actions, NULL, argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    close(fds[1]);
+
+    if (spawned != 0) {
+        close(fds[0]);
+        return false;
+    }
+
+    cbstr_clear(output);
+    while ((len = read(fds[0], buffer, sizeof(buffer))) != 0) {
+        if (len < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        cbstr_concat_cstr(output, buffer, len);
+    }
+    close(fds[0]);
+
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) return false;
+    }
+
+    exit_status(status, result);
+    return true;
+}
+
+size_t proc_wait_any(proc_t *procs, size_t len, proc_status_t *result) {
+    pid_t pid;
+    int status;
+    size_t i;
+
+    for (;;) {
+        pid = waitpid(-1, &status, 0);
+
+        if (pid < 0) {
+            if (errno == EINTR) continue;
+            return len;
+        }
+
+        for (i = 0; i < len; ++i) {
+            if (procs[i] == pid) {
+                break;
+            }
+        }
+
+        // Not one of ours, keep waiting
+        if (i == len) continue;
+
+        exit_status(status, result);
+        return i;
+    }
+}
+
+size_t proc_cpu_count() {
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? (size_t)count : 1;
+}
+
+bool proc_find_program(const char *name, cbstr_t *path) {
+    const char *dirs = getenv("PATH");
+    const char *end;
+
+    // posix_spawnp doesn't search the PATH for names with a slash either
+    if (strchr(name, '/') != NULL) {
+        cbstr_clear(path);
+        cbstr_concat_cstr(path, name, strlen(name));
+        return access(name, X_OK) == 0;
+    }
+
+    if (dirs == NULL) {
+        dirs = "/bin:/usr/bin";
+    }
+
+    for (; *dirs != 0; dirs = *end == 0 ? end : end + 1) {
+        end = strchr(dirs, ':');
+        if (end == NULL) {
+            end = dirs + strlen(dirs);
+        }
+
+        cbstr_clear(path);
+
+        // An empty entry is the current directory
+        if (end != dirs) {
+            cbstr_concat_cstr(path, dirs, end - dirs);
+            cbstr_concat_cstr(path, CB_CSTR("/"));
+        }
+
+        cbstr_concat_cstr(path, name, strlen(name));
+
+        if (access(path->data, X_OK) == 0) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+#endif /* UNIX */
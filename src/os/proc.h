@@ -0,0 +1,47 @@
+/// Author - zebubull
+/// proc.h
+/// A header for spawning and reaping child processes.
+/// Copyright (c) zebubull 2023
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "osdef.h"
+#include "../util/cbstr.h"
+
+#ifdef _WIN32
+#include <windows.h>
+typedef HANDLE proc_t;
+#endif /* _WIN32 */
+
+#ifdef UNIX
+#include <sys/types.h>
+typedef pid_t proc_t;
+#endif /* UNIX */
+
+typedef struct proc_status {
+    // Exit code, 128 + the signal if the process was killed by one
+    int code;
+    // Signal that killed the process, 0 if it exited normally
+    int signal;
+} proc_status_t;
+
+// Starts argv[0] with the given NULL terminated arguments without going
+// through a shell or waiting for it to finish. argv[0] is looked up in the PATH.
+bool proc_spawn(char **argv, proc_t *proc);
+
+// Runs argv[0] like proc_spawn and waits for it, everything it writes to
+// stdout and stderr is collected in `output`. Returns false if it couldn't
+// be started.
+bool proc_run(char **argv, cbstr_t *output, proc_status_t *status);
+
+// Blocks until one of the given processes exits, stores how it exited in
+// `status` and returns its index in `procs`.
+size_t proc_wait_any(proc_t *procs, size_t len, proc_status_t *status);
+
+size_t proc_cpu_count();
+
+// Looks `name` up in the PATH like proc_spawn does and sets `path` to where
+// it was found. Returns false if it wasn't.
+bool proc_find_program(const char *name, cbstr_t *path);
@@ -1,13 +1,39 @@
 #pragma once
 
 #include <time.h>
+#include <stdint.h>
+
+#include "osdef.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#endif /* _WIN32 */
 
 #define TICKS_PER_SECOND 10000000
 #define EPOCH_DIFFERENCE 11644473600LL
+#define NS_PER_SECOND 1000000000LL
 
 inline time_t filetime_to_time_t(long long ft) {
     time_t time;
     time = ft / TICKS_PER_SECOND;
     time = time - EPOCH_DIFFERENCE;
     return time;
-}
\ No newline at end of file
+}
+
+// Nanoseconds from an arbitrary point that never goes backwards, only useful
+// for measuring how long something took.
+static inline int64_t monotonic_ns() {
+    #ifdef _WIN32
+    LARGE_INTEGER counter;
+    LARGE_INTEGER frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (int64_t)(counter.QuadPart / frequency.QuadPart) * NS_PER_SECOND + (int64_t)(counter.QuadPart % frequency.QuadPart) * NS_PER_SECOND / frequency.QuadPart;
+    #endif /* _WIN32 */
+
+    #ifdef UNIX
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * NS_PER_SECOND + now.tv_nsec;
+    #endif /* UNIX */
+}
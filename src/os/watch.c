@@ -0,0 +1,210 @@
+/// Author - zebubull
+/// watch.c
+/// watch.h implementation
+/// Copyright (c) zebubull 2023
+#include "watch.h"
+
+#include "../mem/cbmem.h"
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define WATCH_MASK (IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR | IN_EXCL_UNLINK)
+
+static void clear_events(dir_watch_t *watch) {
+    size_t i;
+
+    for (i = 0; i < watch->events_len; ++i) {
+        cbstr_free(&watch->events[i].name);
+    }
+
+    watch->events_len = 0;
+    watch->rescan = false;
+}
+
+bool dir_watch_init(dir_watch_t *watch) {
+    watch->fd = inotify_init1(IN_CLOEXEC);
+
+    if (watch->fd < 0) {
+        return false;
+    }
+
+    watch->len = 0;
+    watch->cap = 16;
+    watch->wds = MALLOC(watch->cap * sizeof(int));
+    watch->tags = MALLOC(watch->cap * sizeof(size_t));
+    watch->events_len = 0;
+    watch->events_cap = 16;
+    watch->events = MALLOC(watch->events_cap * sizeof(watch_event_t));
+    watch->rescan = false;
+
+    return true;
+}
+
+void dir_watch_free(dir_watch_t *watch) {
+    clear_events(watch);
+    close(watch->fd);
+    FREE(watch->wds);
+    FREE(watch->tags);
+    FREE(watch->events);
+}
+
+bool dir_watch_add(dir_watch_t *watch, const char *path, size_t tag) {
+    int wd = inotify_add_watch(watch->fd, path, WATCH_MASK);
+
+    if (wd < 0) {
+        return false;
+    }
+
+    if (watch->len == watch->cap) {
+        watch->cap <<= 1;
+        watch->wds = REALLOC(watch->wds, watch->cap * sizeof(int));
+        watch->tags = REALLOC(watch->tags, watch->cap * sizeof(size_t));
+    }
+
+    watch->wds[watch->len] = wd;
+    watch->tags[watch->len] = tag;
+    ++watch->len;
+
+    return true;
+}
+
+void dir_watch_clear(dir_watch_t *watch) {
+    size_t i;
+
+    for (i = 0; i < watch->len; ++i) {
+        inotify_rm_watch(watch->fd, watch->wds[i]);
+    }
+
+    watch->len = 0;
+}
+
+static void push_event(dir_watch_t *watch, watch_kind_t kind, size_t dir, const char *name) {
+    size_t i;
+    size_t len = strnlen(name, 256) + 1;
+    watch_event_t *event;
+
+    // Editors tend to create, write and close the same file in one save
+    for (i = 0; i < watch->events_len; ++i) {
+        event = &watch->events[i];
+        if (event->dir == dir && event->name.len == len && memcmp(event->name.data, name, len) == 0) {
+            event->kind = kind;
+            return;
+        }
+    }
+
+    if (watch->events_len == watch->events_cap) {
+        watch->events_cap <<= 1;
+        watch->events = REALLOC(watch->events, watch->events_cap * sizeof(watch_event_t));
+    }
+
+    event = &watch->events[watch->events_len];
+    event->kind = kind;
+    event->dir = dir;
+    event->name = cbstr_from_cstr(name, len);
+    ++watch->events_len;
+}
+
+// Returns false if the inotify descriptor could not be read
+static bool read_events(dir_watch_t *watch) {
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *event;
+    ssize_t len;
+    size_t i;
+    char *ptr;
+
+    len = read(watch->fd, buffer, sizeof(buffer));
+
+    if (len < 0) {
+        return errno == EINTR || errno == EAGAIN;
+    }
+
+    for (ptr = buffer; ptr < buffer + len; ptr += sizeof(struct inotify_event) + event->len) {
+        event = (const struct inotify_event*)ptr;
+
+        if (event->mask & IN_Q_OVERFLOW) {
+            watch->rescan = true;
+            continue;
+        }
+
+        // Sent for every watch removed by dir_watch_clear as well
+        if (event->mask & IN_IGNORED) {
+            continue;
+        }
+
+        if (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_ISDIR)) {
+            watch->rescan = true;
+            continue;
+        }
+
+        if (event->len == 0) {
+            continue;
+        }
+
+        for (i = 0; i < watch->len; ++i) {
+            if (watch->wds[i] == event->wd) {
+                break;
+            }
+        }
+
+        if (i == watch->len) continue;
+
+        if (event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+            push_event(watch, WATCH_REMOVED, watch->tags[i], event->name);
+        } else {
+            push_event(watch, WATCH_CHANGED, watch->tags[i], event->name);
+        }
+    }
+
+    return true;
+}
+
+bool dir_watch_wait(dir_watch_t *watch, int debounce_ms) {
+    struct pollfd pfd;
+    int ready;
+
+    clear_events(watch);
+
+    pfd.fd = watch->fd;
+    pfd.events = POLLIN;
+
+    // Wait for the first event, then until things go quiet
+    ready = poll(&pfd, 1, -1);
+
+    while (ready != 0) {
+        if (ready < 0) {
+            if (errno != EINTR) return false;
+        } else if (!read_events(watch)) {
+            return false;
+        }
+
+        ready = poll(&pfd, 1, debounce_ms);
+    }
+
+    return true;
+}
+
+#else
+
+bool dir_watch_init(dir_watch_t *watch) {
+    return false;
+}
+
+void dir_watch_free(dir_watch_t *watch) {
+}
+
+bool dir_watch_add(dir_watch_t *watch, const char *path, size_t tag) {
+    return false;
+}
+
+void dir_watch_clear(dir_watch_t *watch) {
+}
+
+bool dir_watch_wait(dir_watch_t *watch, int debounce_ms) {
+    return false;
+}
+
+#endif /* __linux__ */
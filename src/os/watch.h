@@ -0,0 +1,59 @@
+/// Author - zebubull
+/// watch.h
+/// A header for waiting on changes to directories.
+/// Copyright (c) zebubull 2023
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#include "osdef.h"
+#include "../util/cbstr.h"
+
+// Only implemented with inotify for now, dir_watch_init fails everywhere else.
+
+typedef enum watch_kind {
+    // A file was written, created or moved into the directory
+    WATCH_CHANGED,
+    // A file was deleted or moved out of the directory
+    WATCH_REMOVED,
+} watch_kind_t;
+
+typedef struct watch_event {
+    watch_kind_t kind;
+    // The tag the directory was added with
+    size_t dir;
+    cbstr_t name;
+} watch_event_t;
+
+typedef struct dir_watch {
+    int fd;
+
+    // Watch descriptors and the tag each one was added with
+    int *wds;
+    size_t *tags;
+    size_t len;
+    size_t cap;
+
+    // Filled in by dir_watch_wait, only valid until the next call
+    watch_event_t *events;
+    size_t events_len;
+    size_t events_cap;
+    // Directories were added or removed, or events were lost, and the whole
+    // tree has to be walked again
+    bool rescan;
+} dir_watch_t;
+
+bool dir_watch_init(dir_watch_t *watch);
+void dir_watch_free(dir_watch_t *watch);
+
+// Starts watching the files directly inside `path`, events for them are
+// reported with `tag`.
+bool dir_watch_add(dir_watch_t *watch, const char *path, size_t tag);
+// Stops watching every directory.
+void dir_watch_clear(dir_watch_t *watch);
+
+// Blocks until something changes, then keeps collecting events until none
+// have arrived for `debounce_ms` so a burst of writes is handled at once.
+// Returns false if the watch stopped working.
+bool dir_watch_wait(dir_watch_t *watch, int debounce_ms);
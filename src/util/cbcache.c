@@ -0,0 +1,280 @@
+/// Author - zebubull
+/// cbcache.c
+/// cbcache.h implementation.
+/// Copyright (c) zebubull 2023
+#include "cbcache.h"
+
+#include "cbhash.h"
+#include "cblog.h"
+#include "../os/dir.h"
+#include "../os/map.h"
+#include "../mem/cbmem.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Trimming goes a bit under the limit so it doesn't happen every build
+#define TRIM_TARGET(limit) ((limit) / 10 * 9)
+
+typedef struct cache_stats {
+    unsigned long long size;
+    unsigned long long hits;
+    unsigned long long misses;
+} cache_stats_t;
+
+static void default_dir(cbstr_t *dir) {
+    const char *base;
+
+    #ifdef _WIN32
+    base = getenv("LOCALAPPDATA");
+    if (base != NULL) {
+        cbstr_concat_cstr(dir, base, strlen(base));
+        cbstr_concat_cstr(dir, CB_CSTR("\\cbuild"));
+        return;
+    }
+    #endif /* _WIN32 */
+
+    #ifdef UNIX
+    base = getenv("XDG_CACHE_HOME");
+    if (base != NULL && *base != 0) {
+        cbstr_concat_cstr(dir, base, strlen(base));
+        cbstr_concat_cstr(dir, CB_CSTR("/cbuild"));
+        return;
+    }
+
+    base = getenv("HOME");
+    if (base != NULL) {
+        cbstr_concat_cstr(dir, base, strlen(base));
+        cbstr_concat_cstr(dir, CB_CSTR("/.cache/cbuild"));
+        return;
+    }
+    #endif /* UNIX */
+
+    cbstr_concat_cstr(dir, CB_CSTR(".cbuild/objects"));
+}
+
+// Sets the scratch path to the object stored under `key`
+static void object_path(cbcache_t *cache, uint64_t key) {
+    char name[24];
+
+    snprintf(name, sizeof(name), "/%02x/%016llx.o", (unsigned)(key >> 56), (unsigned long long)key);
+    cbstr_clear(&cache->path);
+    cbstr_concat(&cache->path, &cache->dir);
+    cbstr_concat_cstr(&cache->path, name, strlen(name));
+    cbstr_localize_path(&cache->path);
+}
+
+static void read_stats(cbcache_t *cache, cache_stats_t *stats) {
+    FILE *file;
+
+    stats->size = 0;
+    stats->hits = 0;
+    stats->misses = 0;
+
+    cbstr_clear(&cache->path);
+    cbstr_concat(&cache->path, &cache->dir);
+    cbstr_concat_cstr(&cache->path, CB_CSTR("/stats"));
+    cbstr_localize_path(&cache->path);
+
+    file = fopen(cache->path.data, "rb");
+    if (!file) {
+        return;
+    }
+
+    if (fscanf(file, "%llu %llu %llu", &stats->size, &stats->hits, &stats->misses) != 3) {
+        stats->size = 0;
+    }
+
+    fclose(file);
+}
+
+static void write_stats(cbcache_t *cache, cache_stats_t *stats) {
+    FILE *file;
+
+    cbstr_clear(&cache->path);
+    cbstr_concat(&cache->path, &cache->dir);
+    cbstr_concat_cstr(&cache->path, CB_CSTR("/stats"));
+    cbstr_localize_path(&cache->path);
+
+    file = fopen(cache->path.data, "wb");
+    if (!file) {
+        return;
+    }
+
+    fprintf(file, "%llu %llu %llu\n", stats->size, stats->hits, stats->misses);
+    fclose(file);
+}
+
+static int compare_write_time(const void *a, const void *b) {
+    const dir_entry_t *x = *(const dir_entry_t**)a;
+    const dir_entry_t *y = *(const dir_entry_t**)b;
+
+    return (x->write_time > y->write_time) - (x->write_time < y->write_time);
+}
+
+// Deletes the least recently used objects until the cache fits under its
+// limit again. Returns the size it was left at.
+static uint64_t trim(cbcache_t *cache) {
+    dir_t objects = walk_dir(cache->dir, 1);
+    dir_entry_t **sorted = MALLOC((objects.entries.len + 1) * sizeof(dir_entry_t*));
+    uint64_t size = 0;
+    size_t len = 0;
+    size_t removed = 0;
+    size_t i;
+
+    for (i = 0; i < objects.entries.len; ++i) {
+        dir_entry_t *entry = entry_list_get(&objects.entries, i);
+        cbstr_t *name = &entry->filename;
+
+        if (name->len < 3 || name->data[name->len-2] != 'o' || name->data[name->len-3] != '.') continue;
+
+        sorted[len++] = entry;
+        size += entry->size;
+    }
+
+    // Hits touch the object, so the oldest write time was used longest ago
+    qsort(sorted, len, sizeof(dir_entry_t*), compare_write_time);
+
+    for (i = 0; i < len && size > TRIM_TARGET(cache->limit); ++i) {
+        cbstr_t *parent = cbstr_list_get(&objects.dir_names, sorted[i]->parent);
+
+        cbstr_clear(&cache->path);
+        cbstr_concat(&cache->path, parent);
+        cbstr_concat_format(&cache->path, CB_CSTR("/%s"), &sorted[i]->filename);
+        cbstr_localize_path(&cache->path);
+
+        if (remove(cache->path.data) == 0) {
+            size -= sorted[i]->size;
+            ++removed;
+        }
+    }
+
+    printf("[INFO] Removed %llu old objects from the object cache.\n", (unsigned long long)removed);
+
+    FREE(sorted);
+    dir_free(&objects);
+
+    return size;
+}
+
+bool cbcache_open(cbcache_t *cache, const char *dir, uint64_t limit) {
+    cache->dir = cbstr_with_cap(64);
+    cache->path = cbstr_with_cap(128);
+    cache->limit = limit;
+    cache->hits = 0;
+    cache->misses = 0;
+    cache->added = 0;
+
+    if (dir != NULL) {
+        cbstr_concat_cstr(&cache->dir, dir, strlen(dir));
+    } else {
+        default_dir(&cache->dir);
+    }
+
+    cbstr_localize_path(&cache->dir);
+    create_dir(cache->dir.data);
+
+    if (!file_exists(cache->dir.data)) {
+        cbstr_free(&cache->path);
+        cbstr_free(&cache->dir);
+        return false;
+    }
+
+    return true;
+}
+
+void cbcache_close(cbcache_t *cache) {
+    cache_stats_t stats;
+
+    read_stats(cache, &stats);
+
+    stats.size += cache->added;
+    stats.hits += cache->hits;
+    stats.misses += cache->misses;
+
+    if (stats.size > cache->limit) {
+        stats.size = trim(cache);
+    }
+
+    write_stats(cache, &stats);
+
+    cbstr_free(&cache->path);
+    cbstr_free(&cache->dir);
+}
+
+bool cbcache_key(uint64_t compiler, cbstr_list_t *command, const char *preprocessed, uint64_t *key) {
+    // A new or updated compiler gets its own objects
+    uint64_t seed = compiler;
+    cbhash_state_t state;
+    file_map_t map;
+    size_t i;
+
+    for (i = 0; i < command->len; ++i) {
+        cbstr_t *arg = cbstr_list_get(command, i);
+        seed = cbhash_bytes(arg->data, arg->len, seed);
+    }
+
+    if (!file_map(preprocessed, &map)) {
+        return false;
+    }
+
+    // With -g gcc puts the working directory on one of the first lines, it
+    // ends up in the object's debug info so it stays part of the key
+    cbhash_init(&state, seed);
+    cbhash_update(&state, map.data, map.size);
+
+    *key = cbhash_final(&state);
+    file_unmap(&map);
+
+    return true;
+}
+
+bool cbcache_fetch(cbcache_t *cache, uint64_t key, const char *object) {
+    object_path(cache, key);
+
+    if (!file_exists(cache->path.data) || !file_link(cache->path.data, object)) {
+        ++cache->misses;
+        return false;
+    }
+
+    file_touch(cache->path.data);
+    ++cache->hits;
+
+    return true;
+}
+
+void cbcache_store(cbcache_t *cache, uint64_t key, const char *object) {
+    int64_t write_time;
+    uint64_t size;
+    cbstr_t temp;
+    size_t i;
+    char end;
+
+    object_path(cache, key);
+
+    if (file_exists(cache->path.data) || !file_stat(object, &write_time, &size)) {
+        return;
+    }
+
+    for (i = cache->path.len - 1; i > 0 && cache->path.data[i] != '/' && cache->path.data[i] != '\\'; --i);
+
+    end = cache->path.data[i];
+    cache->path.data[i] = 0;
+    create_dir(cache->path.data);
+    cache->path.data[i] = end;
+
+    // Linked under a temporary name first so another build never sees half
+    // an object
+    temp = cbstr_copy(&cache->path);
+    cbstr_concat_cstr(&temp, CB_CSTR(".tmp"));
+
+    if (file_link(object, temp.data) && rename(temp.data, cache->path.data) == 0) {
+        cache->added += size;
+    } else {
+        remove(temp.data);
+        eprintf("[WARNING] Could not store '%s' in the object cache.\n", object);
+    }
+
+    cbstr_free(&temp);
+}
@@ -0,0 +1,51 @@
+/// Author - zebubull
+/// cbcache.h
+/// A header for the object cache shared between builds.
+/// Copyright (c) zebubull 2023
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "cbstr.h"
+
+// Objects are stored under a hash of the preprocessed source, the compile
+// command and the compiler binary, so the same compile from any rule or
+// checkout is only ever done once. With -g the preprocessed source names the
+// working directory, so those objects are only shared within one. The cache
+// is trimmed back under its limit, least recently used objects first, when it
+// is closed.
+//
+// Layout - <dir>/<first 2 hex digits of the key>/<key>.o and <dir>/stats,
+// which keeps the total size and lifetime hit and miss counts.
+
+typedef struct cbcache {
+    cbstr_t dir;
+    // Bytes the cache may take up
+    uint64_t limit;
+
+    // Counted for this build only
+    size_t hits;
+    size_t misses;
+    // Bytes stored during this build
+    uint64_t added;
+
+    // Scratch space for object paths
+    cbstr_t path;
+} cbcache_t;
+
+// `dir` may be NULL for the per user default. Returns false if the cache
+// directory could not be used.
+bool cbcache_open(cbcache_t *cache, const char *dir, uint64_t limit);
+// Records this build's counts and trims the cache.
+void cbcache_close(cbcache_t *cache);
+
+// Computes the key of an object built with `command` from the preprocessed
+// source at `preprocessed`, `compiler` identifies the compiler binary (see
+// cbtoolchain_t). Returns false if it could not be read.
+bool cbcache_key(uint64_t compiler, cbstr_list_t *command, const char *preprocessed, uint64_t *key);
+// Links or copies the object stored under `key` to `object`. Returns false
+// on a miss.
+bool cbcache_fetch(cbcache_t *cache, uint64_t key, const char *object);
+void cbcache_store(cbcache_t *cache, uint64_t key, const char *object);
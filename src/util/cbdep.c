@@ -0,0 +1,79 @@
+/// Author - zebubull
+/// cbdep.c
+/// cbdep.h implementation.
+/// Copyright (c) zebubull 2023
+#include "cbdep.h"
+
+#include "../mem/cbmem.h"
+
+#include <stdio.h>
+#include <ctype.h>
+
+void cbdep_parse(char *buffer, size_t len, cbstr_list_t *deps) {
+    size_t i = 0;
+    bool in_target = true;
+    cbstr_t path = cbstr_with_cap(64);
+
+    while (i < len) {
+        char c = buffer[i];
+
+        // Line continuation
+        if (c == '\\' && i + 1 < len && (buffer[i+1] == '\n' || buffer[i+1] == '\r')) {
+            i += 2;
+            continue;
+        }
+
+        if (isspace(c) || (in_target && c == ':' && (i + 1 == len || isspace(buffer[i+1])))) {
+            if (c == ':') {
+                in_target = false;
+            } else if (path.len != 0 && !in_target) {
+                cbstr_list_push(deps, cbstr_copy(&path));
+            }
+
+            cbstr_clear(&path);
+            ++i;
+            continue;
+        }
+
+        // Escaped spaces and hashes are part of the path
+        if (c == '\\' && i + 1 < len && (buffer[i+1] == ' ' || buffer[i+1] == '#')) {
+            c = buffer[++i];
+        } else if (c == '$' && i + 1 < len && buffer[i+1] == '$') {
+            ++i;
+        }
+
+        cbstr_concat_cstr(&path, &c, 1);
+        ++i;
+    }
+
+    if (path.len != 0 && !in_target) {
+        cbstr_list_push(deps, cbstr_copy(&path));
+    }
+
+    cbstr_free(&path);
+}
+
+bool cbdep_load(const char *path, cbstr_list_t *deps) {
+    FILE *file;
+    size_t size;
+    char *data;
+
+    file = fopen(path, "rb");
+
+    if (!file) {
+        return false;
+    }
+
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    data = MALLOC(size + 1);
+    size = fread(data, 1, size, file);
+    fclose(file);
+
+    cbdep_parse(data, size, deps);
+    FREE(data);
+
+    return true;
+}
@@ -0,0 +1,18 @@
+/// Author - zebubull
+/// cbdep.h
+/// A header for reading the dependency files gcc writes with -MMD.
+/// Copyright (c) zebubull 2023
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "cbstr.h"
+
+// Pushes every prerequisite listed in a make-style dependency rule onto
+// `deps`, the target itself is skipped.
+void cbdep_parse(char *buffer, size_t len, cbstr_list_t *deps);
+
+// Reads and parses the dependency file at `path`. Returns false if the file
+// could not be read.
+bool cbdep_load(const char *path, cbstr_list_t *deps);
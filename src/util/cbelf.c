@@ -0,0 +1,96 @@
+/// Author - zebubull
+/// cbelf.c
+/// cbelf.h implementation
+/// Copyright (c) zebubull 2023
+#include "cbelf.h"
+#include "cbhash.h"
+#include "../os/map.h"
+
+#ifdef __linux__
+#include <elf.h>
+#include <string.h>
+
+bool cbelf_interface_hash(const char *path, uint64_t *hash) {
+    file_map_t map;
+    const uint8_t *data;
+    const Elf64_Ehdr *ehdr;
+    const Elf64_Shdr *shdrs;
+    uint64_t sum = 0;
+    uint64_t count = 0;
+    size_t i;
+    size_t j;
+
+    if (!file_map(path, &map)) {
+        return false;
+    }
+
+    data = map.data;
+    ehdr = map.data;
+
+    if (map.size < sizeof(Elf64_Ehdr) || memcmp(ehdr->e_ident, ELFMAG, SELFMAG) != 0
+        || ehdr->e_ident[EI_CLASS] != ELFCLASS64 || ehdr->e_type != ET_DYN
+        || ehdr->e_shentsize != sizeof(Elf64_Shdr)
+        || ehdr->e_shoff > map.size || ehdr->e_shnum > (map.size - ehdr->e_shoff) / sizeof(Elf64_Shdr)) {
+        file_unmap(&map);
+        return false;
+    }
+
+    shdrs = (const Elf64_Shdr*)(data + ehdr->e_shoff);
+
+    for (i = 0; i < ehdr->e_shnum; ++i) {
+        const Elf64_Shdr *symtab = &shdrs[i];
+        const Elf64_Shdr *strtab;
+        const Elf64_Sym *syms;
+
+        if (symtab->sh_type != SHT_DYNSYM || symtab->sh_link >= ehdr->e_shnum) continue;
+
+        strtab = &shdrs[symtab->sh_link];
+
+        if (symtab->sh_offset > map.size || symtab->sh_size > map.size - symtab->sh_offset
+            || strtab->sh_offset > map.size || strtab->sh_size > map.size - strtab->sh_offset) {
+            file_unmap(&map);
+            return false;
+        }
+
+        syms = (const Elf64_Sym*)(data + symtab->sh_offset);
+
+        for (j = 0; j < symtab->sh_size / sizeof(Elf64_Sym); ++j) {
+            const Elf64_Sym *sym = &syms[j];
+            unsigned char bind = ELF64_ST_BIND(sym->st_info);
+            unsigned char type = ELF64_ST_TYPE(sym->st_info);
+            unsigned char visibility = ELF64_ST_VISIBILITY(sym->st_other);
+            const char *name;
+            uint64_t symbol;
+
+            if (sym->st_shndx == SHN_UNDEF || sym->st_name >= strtab->sh_size) continue;
+            if (bind != STB_GLOBAL && bind != STB_WEAK) continue;
+            if (visibility == STV_HIDDEN || visibility == STV_INTERNAL) continue;
+
+            name = (const char*)(data + strtab->sh_offset + sym->st_name);
+            symbol = cbhash_bytes(name, strnlen(name, strtab->sh_size - sym->st_name), CBHASH_SEED);
+            symbol = cbhash_bytes(&sym->st_info, sizeof(sym->st_info), symbol);
+
+            // Programs get their own copy of exported variables, so their
+            // size is part of the interface too
+            if (type == STT_OBJECT || type == STT_TLS) {
+                symbol = cbhash_bytes(&sym->st_size, sizeof(sym->st_size), symbol);
+            }
+
+            // Summed so the order symbols end up in doesn't matter
+            sum += symbol;
+            ++count;
+        }
+    }
+
+    file_unmap(&map);
+    *hash = cbhash_bytes(&count, sizeof(count), sum);
+    return true;
+}
+
+#else
+
+bool cbelf_interface_hash(const char *path, uint64_t *hash) {
+    return false;
+}
+
+#endif /* __linux__ */
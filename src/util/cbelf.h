@@ -0,0 +1,14 @@
+/// Author - zebubull
+/// cbelf.h
+/// A header for reading the exported interface of shared libraries.
+/// Copyright (c) zebubull 2023
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// Hashes every symbol a 64-bit ELF shared library exports, which is all a
+// program linked against it depends on. The hash doesn't change when only the
+// code behind the symbols does. Returns false if `path` isn't one, which is
+// always the case off linux.
+bool cbelf_interface_hash(const char *path, uint64_t *hash);
@@ -0,0 +1,178 @@
+/// Author - zebubull
+/// cbhash.c
+/// cbhash.h implementation.
+/// Copyright (c) zebubull 2023
+#include "cbhash.h"
+
+#include "../mem/cbmem.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define FNV_PRIME 0x100000001b3ULL
+
+uint64_t cbhash_bytes(const void *data, size_t len, uint64_t seed) {
+    const uint8_t *bytes = data;
+    uint64_t hash = seed;
+    size_t i;
+
+    for (i = 0; i < len; ++i) {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
+#define XXH_PRIME1 11400714785074694791ULL
+#define XXH_PRIME2 14029467366897019727ULL
+#define XXH_PRIME3 1609587929392839161ULL
+#define XXH_PRIME4 9650029242287828579ULL
+#define XXH_PRIME5 2870177450012600261ULL
+
+#define FILE_CHUNK 1024 * 64
+
+static inline uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t read64(const uint8_t *p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t xxh_round(uint64_t acc, uint64_t input) {
+    acc += input * XXH_PRIME2;
+    acc = rotl64(acc, 31);
+    return acc * XXH_PRIME1;
+}
+
+static inline uint64_t xxh_merge(uint64_t acc, uint64_t lane) {
+    acc ^= xxh_round(0, lane);
+    return acc * XXH_PRIME1 + XXH_PRIME4;
+}
+
+static void xxh_stripe(cbhash_state_t *state, const uint8_t *p) {
+    state->lanes[0] = xxh_round(state->lanes[0], read64(p));
+    state->lanes[1] = xxh_round(state->lanes[1], read64(p + 8));
+    state->lanes[2] = xxh_round(state->lanes[2], read64(p + 16));
+    state->lanes[3] = xxh_round(state->lanes[3], read64(p + 24));
+}
+
+void cbhash_init(cbhash_state_t *state, uint64_t seed) {
+    state->lanes[0] = seed + XXH_PRIME1 + XXH_PRIME2;
+    state->lanes[1] = seed + XXH_PRIME2;
+    state->lanes[2] = seed;
+    state->lanes[3] = seed - XXH_PRIME1;
+    state->total_len = 0;
+    state->buffered = 0;
+    state->seed = seed;
+}
+
+void cbhash_update(cbhash_state_t *state, const void *data, size_t len) {
+    const uint8_t *p = data;
+    const uint8_t *end = p + len;
+
+    state->total_len += len;
+
+    // Finish off a stripe left over from the last update first
+    if (state->buffered != 0) {
+        size_t fill = sizeof(state->buffer) - state->buffered;
+
+        if (len < fill) {
+            memcpy(state->buffer + state->buffered, p, len);
+            state->buffered += len;
+            return;
+        }
+
+        memcpy(state->buffer + state->buffered, p, fill);
+        xxh_stripe(state, state->buffer);
+        p += fill;
+        state->buffered = 0;
+    }
+
+    while (end - p >= 32) {
+        xxh_stripe(state, p);
+        p += 32;
+    }
+
+    memcpy(state->buffer, p, end - p);
+    state->buffered = end - p;
+}
+
+uint64_t cbhash_final(cbhash_state_t *state) {
+    const uint8_t *p = state->buffer;
+    const uint8_t *end = p + state->buffered;
+    uint64_t hash;
+
+    if (state->total_len >= 32) {
+        hash = rotl64(state->lanes[0], 1) + rotl64(state->lanes[1], 7) + rotl64(state->lanes[2], 12) + rotl64(state->lanes[3], 18);
+        hash = xxh_merge(hash, state->lanes[0]);
+        hash = xxh_merge(hash, state->lanes[1]);
+        hash = xxh_merge(hash, state->lanes[2]);
+        hash = xxh_merge(hash, state->lanes[3]);
+    } else {
+        hash = state->seed + XXH_PRIME5;
+    }
+
+    hash += state->total_len;
+
+    while (end - p >= 8) {
+        hash ^= xxh_round(0, read64(p));
+        hash = rotl64(hash, 27) * XXH_PRIME1 + XXH_PRIME4;
+        p += 8;
+    }
+
+    if (end - p >= 4) {
+        hash ^= (uint64_t)read32(p) * XXH_PRIME1;
+        hash = rotl64(hash, 23) * XXH_PRIME2 + XXH_PRIME3;
+        p += 4;
+    }
+
+    while (p < end) {
+        hash ^= (*p) * XXH_PRIME5;
+        hash = rotl64(hash, 11) * XXH_PRIME1;
+        ++p;
+    }
+
+    hash ^= hash >> 33;
+    hash *= XXH_PRIME2;
+    hash ^= hash >> 29;
+    hash *= XXH_PRIME3;
+    hash ^= hash >> 32;
+
+    return hash;
+}
+
+bool cbhash_file(const char *path, uint64_t *hash) {
+    FILE *file;
+    cbhash_state_t state;
+    size_t read;
+    uint8_t *buffer;
+
+    file = fopen(path, "rb");
+
+    if (!file) {
+        return false;
+    }
+
+    buffer = MALLOC(FILE_CHUNK);
+    cbhash_init(&state, 0);
+
+    while ((read = fread(buffer, 1, FILE_CHUNK, file)) != 0) {
+        cbhash_update(&state, buffer, read);
+    }
+
+    FREE(buffer);
+    fclose(file);
+
+    *hash = cbhash_final(&state);
+    return true;
+}
@@ -0,0 +1,30 @@
+/// Author - zebubull
+/// cbhash.h
+/// A header for fast non-cryptographic hashing.
+/// Copyright (c) zebubull 2023
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define CBHASH_SEED 0xcbf29ce484222325ULL
+
+// FNV-1a, `seed` lets hashes be chained over several buffers.
+uint64_t cbhash_bytes(const void *data, size_t len, uint64_t seed);
+
+// Streaming XXH64, used for file contents where FNV would be too slow.
+typedef struct cbhash_state {
+    uint64_t lanes[4];
+    uint64_t total_len;
+    uint8_t buffer[32];
+    size_t buffered;
+    uint64_t seed;
+} cbhash_state_t;
+
+void cbhash_init(cbhash_state_t *state, uint64_t seed);
+void cbhash_update(cbhash_state_t *state, const void *data, size_t len);
+uint64_t cbhash_final(cbhash_state_t *state);
+
+// Hashes the contents of a file, returns false if it could not be read.
+bool cbhash_file(const char *path, uint64_t *hash);
@@ -58,8 +58,33 @@ void cbstr_clear(cbstr_t* str) {
     str->len = 0;
 }
 
+cbstr_t cbstr_arena_from_cstr(cbarena_t *arena, const char *cstr, size_t len) {
+    cbstr_t str;
+    bool needs_zero = cstr[len-1] != '\0';
+
+    str.data = cbarena_alloc(arena, len + needs_zero);
+    memcpy(str.data, cstr, len);
+
+    if (needs_zero) {
+        str.data[len] = 0;
+        ++len;
+    }
+
+    str.len = len;
+    str.capacity = 0;
+
+    return str;
+}
+
+cbstr_t cbstr_arena_copy(cbarena_t *arena, cbstr_t *str) {
+    return cbstr_arena_from_cstr(arena, str->data, str->len);
+}
+
 void ALLOC_DEF(cbstr_free, cbstr_t *str) {
-    FFREE(str->data);
+    // Borrowed data belongs to someone else
+    if (str->capacity != 0) {
+        FFREE(str->data);
+    }
     str->capacity = 0;
     str->len = 0;
 }
@@ -151,7 +176,16 @@ void cbstr_concat_cstr(cbstr_t *a, const char *b, size_t len) {
 
     if (a->capacity < new_len) {
         size_t new_cap = (new_len << 1) - (new_len >> 1);
-        a->data = REALLOC(a->data, new_cap);
+
+        if (a->capacity == 0 && a->len != 0) {
+            // Borrowed, move it to the heap before growing
+            char *data = MALLOC(new_cap);
+            memcpy(data, a->data, a->len);
+            a->data = data;
+        } else {
+            a->data = REALLOC(a->data, new_cap);
+        }
+
         a->capacity = new_cap;
     }
     
@@ -159,7 +193,7 @@ void cbstr_concat_cstr(cbstr_t *a, const char *b, size_t len) {
     a->len = new_len;
 
     if (needs_zero) {
-        a->data[new_len] = 0;
+        a->data[new_len - 1] = 0;
     }
 }
 
@@ -216,7 +250,8 @@ void ALLOC_DEF(cbstr_list_free, cbstr_list_t *list) {
 
 void cbstr_list_push(cbstr_list_t *list, cbstr_t str) {
     if (list->len == list->cap) {
-        list->cap = (list->cap << 2) - (list->cap >> 1);
+        // A list made with no capacity would never grow otherwise
+        list->cap = list->cap == 0 ? 4 : (list->cap << 2) - (list->cap >> 1);
         list->strings = REALLOC(list->strings, list->cap * sizeof(cbstr_t));
     }
 
@@ -8,6 +8,8 @@
 #include <stdint.h>
 #include <stdbool.h>
 
+// A capacity of 0 means the data is borrowed (a view or arena memory), it is
+// never freed and gets copied to the heap the first time the string grows.
 typedef struct cbstr {
     char *data;
     size_t len;
@@ -43,12 +45,18 @@ typedef struct cbstr_list {
 #endif /* RELEASE */
 
 #define CB_CSTR(s) s, sizeof(s)
+// Borrowed string literal, must not be cleared or written to
+#define CB_VIEW(s) ((cbstr_t){.data = (char*)(s), .len = sizeof(s), .capacity = 0})
 
 cbstr_t ALLOC_DEF(cbstr_from_cstr, const char* cstr, size_t len);
 cbstr_t ALLOC_DEF(cbstr_with_cap, size_t cap);
 cbstr_t ALLOC_DEF(cbstr_copy, cbstr_t *str);
 void ALLOC_DEF(cbstr_free, cbstr_t *str);
 
+// Allocated from the arena and freed along with it.
+cbstr_t cbstr_arena_from_cstr(cbarena_t *arena, const char *cstr, size_t len);
+cbstr_t cbstr_arena_copy(cbarena_t *arena, cbstr_t *str);
+
 void cbstr_concat(cbstr_t *a, cbstr_t *b);
 void cbstr_concat_slice(cbstr_t *a, cbstr_t *b, size_t offset);
 void cbstr_concat_format(cbstr_t *a, const char *format, size_t len, ...);
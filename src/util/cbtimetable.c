@@ -8,135 +8,781 @@
 #include "../os/osdef.h"
 #include "../mem/cbmem.h"
 #include "../util/cblog.h"
+#include "../os/dir.h"
+#include "cbhash.h"
 
+#include <stddef.h>
 #include <stdio.h>
+#include <string.h>
 
-void ALLOC_DEF(tt_entry_free, tt_entry_t *entry) {
-    FORWARD(cbstr_free, &entry->file_name);
-    FORWARD(cbstr_free, &entry->parent_dirs);
-    FORWARD(cbstr_free, &entry->obj_file);
+#define TT_MIN_CAPACITY 4
+// Entries of version 7 files stop short of `used`
+#define TT_V7_ENTRY_SIZE offsetof(tt_entry_t, used)
+
+// Grows an array to hold at least `needed` items. Arrays that still point
+// into the mapped file have no capacity and get copied to the heap instead.
+static void *tt_reserve(void *data, size_t *capacity, size_t len, size_t needed, size_t size) {
+    size_t new_cap;
+    void *new_data;
+
+    if (needed <= *capacity) {
+        return data;
+    }
+
+    new_cap = *capacity > len ? *capacity : len;
+    if (new_cap < TT_MIN_CAPACITY) {
+        new_cap = TT_MIN_CAPACITY;
+    }
+
+    while (new_cap < needed) {
+        // capacity *= 1.5
+        new_cap = (new_cap << 1) - (new_cap >> 1);
+    }
+
+    if (*capacity == 0) {
+        new_data = MALLOC(new_cap * size);
+        if (len != 0) {
+            memcpy(new_data, data, len * size);
+        }
+    } else {
+        new_data = REALLOC(data, new_cap * size);
+    }
+
+    *capacity = new_cap;
+    return new_data;
+}
+
+static tt_index_t ALLOC_DEF(tt_index_init, size_t items) {
+    tt_index_t index;
+
+    // Keep the load factor at or below one half
+    index.capacity = 8;
+    while (index.capacity < (items << 1)) {
+        index.capacity <<= 1;
+    }
+
+    index.slots = FMALLOC(index.capacity * sizeof(tt_slot_t));
+    memset(index.slots, 0, index.capacity * sizeof(tt_slot_t));
+    index.owned = true;
+
+    return index;
+}
+
+static void tt_index_insert(tt_index_t *index, uint32_t hash, size_t item) {
+    size_t mask = index->capacity - 1;
+    size_t i = hash & mask;
+
+    while (index->slots[i].item != 0) {
+        i = (i + 1) & mask;
+    }
+
+    index->slots[i].hash = hash;
+    index->slots[i].item = (uint32_t)(item + 1);
+}
+
+// Makes room for one more item, `items` is the count before inserting.
+static void tt_index_reserve(tt_index_t *index, size_t items) {
+    tt_slot_t *old_slots;
+    size_t old_capacity;
+    size_t i;
+
+    if (((items + 1) << 1) <= index->capacity) {
+        if (!index->owned) {
+            old_slots = index->slots;
+            index->slots = MALLOC(index->capacity * sizeof(tt_slot_t));
+            memcpy(index->slots, old_slots, index->capacity * sizeof(tt_slot_t));
+            index->owned = true;
+        }
+        return;
+    }
+
+    old_slots = index->slots;
+    old_capacity = index->capacity;
+
+    index->capacity <<= 1;
+    index->slots = MALLOC(index->capacity * sizeof(tt_slot_t));
+    memset(index->slots, 0, index->capacity * sizeof(tt_slot_t));
+
+    for (i = 0; i < old_capacity; ++i) {
+        if (old_slots[i].item != 0) {
+            tt_index_insert(index, old_slots[i].hash, old_slots[i].item - 1);
+        }
+    }
+
+    if (index->owned) {
+        FREE(old_slots);
+    }
+    index->owned = true;
+}
+
+static uint32_t tt_entry_hash(cbstr_t *file, cbstr_t *parent, uint64_t command) {
+    uint64_t hash = cbhash_bytes(parent->data, parent->len, cbhash_bytes(&command, sizeof(command), CBHASH_SEED));
+    return (uint32_t)cbhash_bytes(file->data, file->len, hash);
+}
+
+static uint32_t tt_path_hash(cbstr_t *path) {
+    return (uint32_t)cbhash_bytes(path->data, path->len, CBHASH_SEED);
 }
 
 tt_t ALLOC_DEF(tt_init, size_t cap) {
     tt_t table;
+
+    if (cap < TT_MIN_CAPACITY) {
+        cap = TT_MIN_CAPACITY;
+    }
+
     table.len = 0;
     table.capacity = cap;
     table.files = FMALLOC(cap * sizeof(tt_entry_t));
+    table.files_index = FORWARD(tt_index_init, cap);
+
+    table.deps_len = 0;
+    table.deps_capacity = TT_MIN_CAPACITY;
+    table.deps = FMALLOC(table.deps_capacity * sizeof(tt_dep_t));
+    table.deps_index = FORWARD(tt_index_init, table.deps_capacity);
+
+    table.dep_lists_len = 0;
+    table.dep_lists_capacity = cap;
+    table.dep_lists = FMALLOC(table.dep_lists_capacity * sizeof(uint32_t));
+
+    table.strings_len = 0;
+    table.strings_capacity = cap * 32;
+    table.strings = FMALLOC(table.strings_capacity);
+    table.garbage = 0;
+
+    table.map.data = NULL;
+    table.map.size = 0;
+    table.generation = 0;
+    table.dirty = true;
 
     return table;
 }
 
 void ALLOC_DEF(tt_free, tt_t *table) {
+    if (table->capacity != 0) FFREE(table->files);
+    if (table->files_index.owned) FFREE(table->files_index.slots);
+    if (table->deps_capacity != 0) FFREE(table->deps);
+    if (table->deps_index.owned) FFREE(table->deps_index.slots);
+    if (table->dep_lists_capacity != 0) FFREE(table->dep_lists);
+    if (table->strings_capacity != 0) FFREE(table->strings);
+
+    file_unmap(&table->map);
+}
+
+static uint32_t tt_push_string(tt_t *table, const char *data, uint32_t len) {
+    uint32_t offset = (uint32_t)table->strings_len;
+
+    table->strings = tt_reserve(table->strings, &table->strings_capacity, table->strings_len, table->strings_len + sizeof(len) + len, 1);
+
+    // Strings aren't aligned so the prefix is always copied in and out
+    memcpy(table->strings + offset, &len, sizeof(len));
+    memcpy(table->strings + offset + sizeof(len), data, len);
+    table->strings_len += sizeof(len) + len;
+
+    return offset;
+}
+
+cbstr_t tt_string(tt_t *table, uint32_t offset) {
+    cbstr_t str;
+    uint32_t len;
+
+    memcpy(&len, table->strings + offset, sizeof(len));
+    str.data = table->strings + offset + sizeof(len);
+    str.len = len;
+    str.capacity = 0;
+
+    return str;
+}
+
+static void tt_push(tt_t *table, tt_entry_t entry, uint32_t hash) {
+    table->files = tt_reserve(table->files, &table->capacity, table->len, table->len + 1, sizeof(tt_entry_t));
+
+    tt_index_reserve(&table->files_index, table->len);
+    tt_index_insert(&table->files_index, hash, table->len);
+
+    table->files[table->len] = entry;
+    ++table->len;
+}
+
+static void tt_push_dep(tt_t *table, tt_dep_t dep, uint32_t hash) {
+    table->deps = tt_reserve(table->deps, &table->deps_capacity, table->deps_len, table->deps_len + 1, sizeof(tt_dep_t));
+
+    tt_index_reserve(&table->deps_index, table->deps_len);
+    tt_index_insert(&table->deps_index, hash, table->deps_len);
+
+    table->deps[table->deps_len] = dep;
+    ++table->deps_len;
+}
+
+tt_entry_t *tt_search(tt_t *table, cbstr_t *file, cbstr_t *parent, uint64_t command) {
+    uint32_t hash = tt_entry_hash(file, parent, command);
+    size_t mask = table->files_index.capacity - 1;
     size_t i;
 
-    for (i = 0; i < table->len; ++i) {
-        FORWARD(tt_entry_free, table->files + i);
+    for (i = hash & mask; table->files_index.slots[i].item != 0; i = (i + 1) & mask) {
+        tt_slot_t *slot = &table->files_index.slots[i];
+        tt_entry_t *entry;
+        cbstr_t file_name;
+        cbstr_t parent_dirs;
+
+        if (slot->hash != hash) continue;
+
+        entry = &table->files[slot->item - 1];
+        if (entry->command != command) continue;
+
+        file_name = tt_string(table, entry->file_name);
+        parent_dirs = tt_string(table, entry->parent_dirs);
+
+        if (cbstr_cmp(&file_name, file) && cbstr_cmp(&parent_dirs, parent)) {
+            // Only worth saving along with something else, a build that
+            // changed nothing doesn't move the saved generation either
+            entry->used = table->generation;
+            return entry;
+        }
     }
 
-    FFREE(table->files);
+    return NULL;
 }
 
-void tt_push(tt_t *table, tt_entry_t entry) {
-    if (table->len == table->capacity) {
-        // capacity *= 1.5
-        table->capacity = (table->capacity << 1) - (table->capacity >> 1);
-        table->files = REALLOC(table->files, table->capacity * sizeof(tt_entry_t));
+void tt_begin_build(tt_t *table) {
+    // Every header was checked in an older generation, so this is all it takes
+    ++table->generation;
+}
+
+// Takes a fresh stamp of a file, a missing file gets one that never matches.
+static void tt_stamp_file(tt_stamp_t *stamp, const char *path) {
+    if (!file_stat(path, &stamp->write_time, &stamp->size) || !cbhash_file(path, &stamp->hash)) {
+        stamp->write_time = -1;
+        stamp->size = TT_SIZE_UNKNOWN - 1;
+        stamp->hash = 0;
     }
+}
 
-    table->files[table->len] = entry;
-    ++table->len;
+// Whether the contents of a file differ from its stamp. The file is only
+// hashed when its write time moved but its size did not, and a matching hash
+// just moves the stamp forward.
+static bool tt_stamp_changed(tt_t *table, tt_stamp_t *stamp, const char *path, int64_t write_time, uint64_t size) {
+    uint64_t hash;
+
+    if (stamp->size == TT_SIZE_UNKNOWN) {
+        // Migrated from a format that only kept whole seconds
+        #ifdef UNIX
+        if (stamp->write_time != write_time / NS_PER_SECOND) return true;
+        #endif /* UNIX */
+        #ifdef _WIN32
+        if (stamp->write_time != write_time) return true;
+        #endif /* _WIN32 */
+
+        if (!cbhash_file(path, &stamp->hash)) return true;
+    } else {
+        if (stamp->write_time == write_time && stamp->size == size) return false;
+        if (stamp->size != size) return true;
+        if (!cbhash_file(path, &hash) || hash != stamp->hash) return true;
+    }
+
+    stamp->write_time = write_time;
+    stamp->size = size;
+    table->dirty = true;
+
+    return false;
+}
+
+// Checks a header at most once per build and records when it changed.
+static void tt_check_dep(tt_t *table, tt_dep_t *dep) {
+    int64_t write_time;
+    uint64_t size;
+    cbstr_t path;
+
+    if (dep->checked == table->generation) {
+        return;
+    }
+
+    dep->checked = table->generation;
+    path = tt_string(table, dep->path);
+
+    // A missing header always forces a rebuild so the compiler can complain about it
+    if (!file_stat(path.data, &write_time, &size) || tt_stamp_changed(table, &dep->stamp, path.data, write_time, size)) {
+        tt_stamp_file(&dep->stamp, path.data);
+        dep->changed = table->generation;
+        table->dirty = true;
+    }
 }
 
-void write_cbstr(cbstr_t *str, FILE *file) {
-    const uint32_t len = str->len;
-    fwrite(&len, sizeof(len), 1, file);
-    fwrite(str->data, 1, len, file);
+static uint32_t tt_dep_index(tt_t *table, cbstr_t *path) {
+    uint32_t hash = tt_path_hash(path);
+    size_t mask = table->deps_index.capacity - 1;
+    size_t i;
+    tt_dep_t dep;
+
+    for (i = hash & mask; table->deps_index.slots[i].item != 0; i = (i + 1) & mask) {
+        tt_slot_t *slot = &table->deps_index.slots[i];
+        tt_dep_t *found;
+        cbstr_t found_path;
+
+        if (slot->hash != hash) continue;
+
+        found = &table->deps[slot->item - 1];
+        found_path = tt_string(table, found->path);
+
+        if (cbstr_cmp(&found_path, path)) {
+            tt_check_dep(table, found);
+            return slot->item - 1;
+        }
+    }
+
+    tt_stamp_file(&dep.stamp, path->data);
+    dep.changed = table->generation;
+    dep.checked = table->generation;
+    dep.path = tt_push_string(table, path->data, (uint32_t)path->len);
+    dep.reserved = 0;
+
+    tt_push_dep(table, dep, hash);
+    return (uint32_t)(table->deps_len - 1);
 }
 
-void tt_save(tt_t *table, FILE *file) {
+static void tt_set_deps(tt_t *table, tt_entry_t *entry, cbstr_list_t *deps) {
     size_t i;
-    const uint16_t magic_num = TT_MAGIC;
-    const uint16_t version = TT_VERSION;
-    const uint32_t num_entries = (uint32_t)table->len;
 
-    fwrite(&magic_num, 1, sizeof(magic_num), file);
-    fwrite(&version, 1, sizeof(version), file);
-    fwrite(&num_entries, 1, sizeof(num_entries), file);
-    fwrite(&table->build_success, 1, sizeof(table->build_success), file);
+    // Reuse the old list when the new one fits, which is almost always
+    if (deps->len > entry->dep_count) {
+        table->garbage += entry->dep_count * sizeof(uint32_t);
+        table->dep_lists = tt_reserve(table->dep_lists, &table->dep_lists_capacity, table->dep_lists_len, table->dep_lists_len + deps->len, sizeof(uint32_t));
+        entry->deps = (uint32_t)table->dep_lists_len;
+        table->dep_lists_len += deps->len;
+    } else {
+        table->garbage += (entry->dep_count - deps->len) * sizeof(uint32_t);
+    }
+
+    entry->dep_count = (uint32_t)deps->len;
 
-    for (i = 0; i < num_entries; ++i) {
-        tt_entry_t *entry = table->files + i;
+    for (i = 0; i < deps->len; ++i) {
+        table->dep_lists[entry->deps + i] = tt_dep_index(table, cbstr_list_get(deps, i));
+    }
+}
 
-        fwrite(&entry->write_time, sizeof(entry->write_time), 1, file);
-        write_cbstr(&entry->file_name, file);
-        write_cbstr(&entry->parent_dirs, file);
-        write_cbstr(&entry->obj_file, file);
+void tt_record(tt_t *table, cbstr_t *file, cbstr_t *parent, uint64_t command, cbstr_t *object, tt_stamp_t *stamp, cbstr_list_t *deps) {
+    tt_entry_t *entry = tt_search(table, file, parent, command);
+
+    if (entry == NULL) {
+        tt_entry_t new_entry;
+
+        new_entry.command = command;
+        new_entry.file_name = tt_push_string(table, file->data, (uint32_t)file->len);
+        new_entry.parent_dirs = tt_push_string(table, parent->data, (uint32_t)parent->len);
+        new_entry.obj_file = tt_push_string(table, object->data, (uint32_t)object->len);
+        new_entry.deps = 0;
+        new_entry.dep_count = 0;
+        new_entry.used = table->generation;
+        new_entry.reserved = 0;
+
+        tt_push(table, new_entry, tt_entry_hash(file, parent, command));
+        entry = &table->files[table->len - 1];
+    } else {
+        cbstr_t obj_file = tt_string(table, entry->obj_file);
+
+        if (!cbstr_cmp(&obj_file, object)) {
+            table->garbage += sizeof(uint32_t) + obj_file.len;
+            entry->obj_file = tt_push_string(table, object->data, (uint32_t)object->len);
+        }
     }
 
-    fflush(file);
+    entry->stamp = *stamp;
+    entry->built = table->generation;
+    tt_set_deps(table, entry, deps);
+
+    table->dirty = true;
 }
 
-cbstr_t read_cbstr(FILE *file) {
+bool tt_entry_source_changed(tt_t *table, tt_entry_t *entry, const char *path, int64_t write_time, uint64_t size) {
+    return tt_stamp_changed(table, &entry->stamp, path, write_time, size);
+}
+
+bool tt_entry_deps_changed(tt_t *table, tt_entry_t *entry) {
+    uint32_t i;
+
+    for (i = 0; i < entry->dep_count; ++i) {
+        tt_dep_t *dep = &table->deps[table->dep_lists[entry->deps + i]];
+        tt_check_dep(table, dep);
+
+        if (dep->changed > entry->built) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool tt_entry_dep_changed(tt_t *table, tt_entry_t *entry, uint32_t index, cbstr_t *path) {
+    tt_dep_t *dep = &table->deps[table->dep_lists[entry->deps + index]];
+    tt_check_dep(table, dep);
+
+    *path = tt_string(table, dep->path);
+    return dep->changed > entry->built;
+}
+
+static uint32_t tt_move_string(tt_t *table, const char *strings, uint32_t offset) {
     uint32_t len;
-    cbstr_t str;
 
-    fread(&len, 1, sizeof(len), file);
-    str = cbstr_with_cap(len);
-    fread(str.data, 1, len, file);
-    str.len = len;
+    memcpy(&len, strings + offset, sizeof(len));
+    return tt_push_string(table, strings + offset + sizeof(len), len);
+}
 
-    return str;
+// Drops every string and header list nothing refers to anymore.
+static void tt_compact(tt_t *table) {
+    char *old_strings = table->strings;
+    size_t old_strings_capacity = table->strings_capacity;
+    uint32_t *old_lists = table->dep_lists;
+    size_t old_lists_capacity = table->dep_lists_capacity;
+    size_t i;
+
+    table->strings = NULL;
+    table->strings_len = 0;
+    table->strings_capacity = 0;
+    table->dep_lists = NULL;
+    table->dep_lists_len = 0;
+    table->dep_lists_capacity = 0;
+
+    for (i = 0; i < table->deps_len; ++i) {
+        table->deps[i].path = tt_move_string(table, old_strings, table->deps[i].path);
+    }
+
+    for (i = 0; i < table->len; ++i) {
+        tt_entry_t *entry = &table->files[i];
+
+        entry->file_name = tt_move_string(table, old_strings, entry->file_name);
+        entry->parent_dirs = tt_move_string(table, old_strings, entry->parent_dirs);
+        entry->obj_file = tt_move_string(table, old_strings, entry->obj_file);
+
+        table->dep_lists = tt_reserve(table->dep_lists, &table->dep_lists_capacity, table->dep_lists_len, table->dep_lists_len + entry->dep_count + 1, sizeof(uint32_t));
+        memcpy(table->dep_lists + table->dep_lists_len, old_lists + entry->deps, entry->dep_count * sizeof(uint32_t));
+        entry->deps = (uint32_t)table->dep_lists_len;
+        table->dep_lists_len += entry->dep_count;
+    }
+
+    if (old_strings_capacity != 0) FREE(old_strings);
+    if (old_lists_capacity != 0) FREE(old_lists);
+    table->garbage = 0;
 }
 
-void tt_load(tt_t *table, FILE *file) {
+static bool tt_expired(tt_t *table, tt_entry_t *entry) {
+    return entry->used + TT_MAX_AGE < table->generation;
+}
+
+// Empties an index and inserts every item again, it never has to grow since
+// items were only taken out.
+static void tt_index_clear(tt_index_t *index) {
+    if (!index->owned) {
+        index->slots = MALLOC(index->capacity * sizeof(tt_slot_t));
+        index->owned = true;
+    }
+
+    memset(index->slots, 0, index->capacity * sizeof(tt_slot_t));
+}
+
+// Drops every entry that hasn't been looked up in TT_MAX_AGE generations and
+// every header only they included. Their strings and header lists are left
+// for tt_compact.
+static void tt_expire(tt_t *table) {
+    uint32_t *remap;
+    size_t kept = 0;
     size_t i;
-    uint16_t magic_num;
-    uint16_t version;
-    uint32_t num_entries;
+    uint32_t j;
 
-    fread(&magic_num, 1, sizeof(magic_num), file);
+    for (i = 0; i < table->len; ++i) {
+        if (!tt_expired(table, &table->files[i])) ++kept;
+    }
 
-    if (magic_num != TT_MAGIC) {
-        *table = tt_init(4);
-        eprintf("[WARNING] Invalid timetable file, skipping incremental compilation...\n");
+    if (kept == table->len) {
         return;
     }
 
-    fread(&version, 1, sizeof(version), file);
+    // Anything still in the mapped file is copied out before it is rewritten
+    table->files = tt_reserve(table->files, &table->capacity, table->len, table->len, sizeof(tt_entry_t));
+    table->deps = tt_reserve(table->deps, &table->deps_capacity, table->deps_len, table->deps_len, sizeof(tt_dep_t));
+    table->dep_lists = tt_reserve(table->dep_lists, &table->dep_lists_capacity, table->dep_lists_len, table->dep_lists_len, sizeof(uint32_t));
 
-    if (version != TT_VERSION) {
-        *table = tt_init(4);
-        eprintf("[WARNING] Outdated timetable file, skipping incremental compilation...\n");
+    // UINT32_MAX marks a header no kept entry includes
+    remap = MALLOC((table->deps_len + 1) * sizeof(uint32_t));
+    memset(remap, 0xff, (table->deps_len + 1) * sizeof(uint32_t));
+
+    kept = 0;
+    for (i = 0; i < table->len; ++i) {
+        tt_entry_t *entry = &table->files[i];
+
+        if (tt_expired(table, entry)) {
+            table->garbage += 3 * sizeof(uint32_t) + entry->dep_count * sizeof(uint32_t);
+            table->garbage += tt_string(table, entry->file_name).len + tt_string(table, entry->parent_dirs).len + tt_string(table, entry->obj_file).len;
+            continue;
+        }
+
+        for (j = 0; j < entry->dep_count; ++j) {
+            remap[table->dep_lists[entry->deps + j]] = 0;
+        }
+
+        table->files[kept++] = *entry;
+    }
+
+    table->len = kept;
+
+    kept = 0;
+    for (i = 0; i < table->deps_len; ++i) {
+        if (remap[i] == UINT32_MAX) {
+            table->garbage += sizeof(uint32_t) + tt_string(table, table->deps[i].path).len;
+            continue;
+        }
+
+        remap[i] = (uint32_t)kept;
+        table->deps[kept++] = table->deps[i];
+    }
+
+    table->deps_len = kept;
+
+    for (i = 0; i < table->len; ++i) {
+        tt_entry_t *entry = &table->files[i];
+
+        for (j = 0; j < entry->dep_count; ++j) {
+            table->dep_lists[entry->deps + j] = remap[table->dep_lists[entry->deps + j]];
+        }
+    }
+
+    FREE(remap);
+
+    tt_index_clear(&table->files_index);
+    for (i = 0; i < table->len; ++i) {
+        cbstr_t file_name = tt_string(table, table->files[i].file_name);
+        cbstr_t parent_dirs = tt_string(table, table->files[i].parent_dirs);
+        tt_index_insert(&table->files_index, tt_entry_hash(&file_name, &parent_dirs, table->files[i].command), i);
+    }
+
+    tt_index_clear(&table->deps_index);
+    for (i = 0; i < table->deps_len; ++i) {
+        cbstr_t path = tt_string(table, table->deps[i].path);
+        tt_index_insert(&table->deps_index, tt_path_hash(&path), i);
+    }
+}
+
+#ifdef _WIN32
+// Copies everything still in the mapped file to the heap and unmaps it.
+static void tt_detach(tt_t *table) {
+    table->files = tt_reserve(table->files, &table->capacity, table->len, table->len + 1, sizeof(tt_entry_t));
+    table->deps = tt_reserve(table->deps, &table->deps_capacity, table->deps_len, table->deps_len + 1, sizeof(tt_dep_t));
+    table->dep_lists = tt_reserve(table->dep_lists, &table->dep_lists_capacity, table->dep_lists_len, table->dep_lists_len + 1, sizeof(uint32_t));
+    table->strings = tt_reserve(table->strings, &table->strings_capacity, table->strings_len, table->strings_len + 1, 1);
+    tt_index_reserve(&table->files_index, 0);
+    tt_index_reserve(&table->deps_index, 0);
+
+    file_unmap(&table->map);
+}
+#endif /* _WIN32 */
+
+void tt_save(tt_t *table, const char *path) {
+    FILE *file;
+    tt_header_t header;
+    cbstr_t write_path;
+
+    if (!table->dirty) {
         return;
     }
 
-    fread(&num_entries, 1, sizeof(num_entries), file);
+    tt_expire(table);
 
-    *table = tt_init(num_entries);
+    if (table->garbage > ((table->strings_len + table->dep_lists_len * sizeof(uint32_t)) >> 1)) {
+        tt_compact(table);
+    }
+
+    write_path = cbstr_from_cstr(path, strnlen(path, 260));
+
+    #ifdef _WIN32
+    // Windows won't replace a file that is still mapped
+    tt_detach(table);
+    #endif /* _WIN32 */
+
+    #ifdef UNIX
+    // The old file stays mapped until the table is freed, so write next to it and swap it in
+    cbstr_concat_cstr(&write_path, CB_CSTR(".tmp"));
+    #endif /* UNIX */
+
+    file = fopen(write_path.data, "wb");
+
+    if (!file) {
+        eprintf("[WARNING] Could not open timetable file.\n");
+        cbstr_free(&write_path);
+        return;
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.magic = TT_MAGIC;
+    header.version = TT_VERSION;
+    header.entries = (uint32_t)table->len;
+    header.deps = (uint32_t)table->deps_len;
+    header.files_index = (uint32_t)table->files_index.capacity;
+    header.deps_index = (uint32_t)table->deps_index.capacity;
+    header.dep_lists = (uint32_t)table->dep_lists_len;
+    header.strings = (uint32_t)table->strings_len;
+    header.generation = table->generation;
+
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(table->files, sizeof(tt_entry_t), table->len, file);
+    fwrite(table->deps, sizeof(tt_dep_t), table->deps_len, file);
+    fwrite(table->files_index.slots, sizeof(tt_slot_t), table->files_index.capacity, file);
+    fwrite(table->deps_index.slots, sizeof(tt_slot_t), table->deps_index.capacity, file);
+    fwrite(table->dep_lists, sizeof(uint32_t), table->dep_lists_len, file);
+    fwrite(table->strings, 1, table->strings_len, file);
+    fclose(file);
+
+    #ifdef UNIX
+    rename(write_path.data, path);
+    #endif /* UNIX */
+
+    table->dirty = false;
+    cbstr_free(&write_path);
+}
+
+// Version 3 and 4 files have no command hashes, so none of their entries
+// would ever be found again. Only the generation is kept and the first build
+// records everything again.
+static void tt_migrate(tt_t *table, FILE *file, uint16_t version) {
+    uint32_t num_entries;
+    bool build_success;
 
-    fread(&table->build_success, 1, sizeof(table->build_success), file);
+    fread(&num_entries, 1, sizeof(num_entries), file);
 
-    for (i = 0; i < num_entries; ++i) {
-        tt_entry_t entry;
+    *table = tt_init(num_entries);
 
-        fread(&entry.write_time, 1, sizeof(entry.write_time), file);
-        entry.file_name = read_cbstr(file);
-        entry.parent_dirs = read_cbstr(file);
-        entry.obj_file = read_cbstr(file);
+    // Links are tracked per output now
+    fread(&build_success, 1, sizeof(build_success), file);
 
-        tt_push(table, entry);
+    if (version >= 4) {
+        fread(&table->generation, 1, sizeof(table->generation), file);
     }
+
+    printf("[INFO] Migrated version %d timetable.\n", version);
+    table->dirty = true;
 }
 
-tt_entry_t *tt_search(tt_t *table, cbstr_t *file, cbstr_t *parent) {
+// Version 7 entries are the current ones without `used`, they all count as
+// used by the build that saved them.
+static void tt_upgrade_entries(tt_t *table, const char *data, uint32_t generation) {
     size_t i;
 
+    table->capacity = table->len > TT_MIN_CAPACITY ? table->len : TT_MIN_CAPACITY;
+    table->files = MALLOC(table->capacity * sizeof(tt_entry_t));
+
     for (i = 0; i < table->len; ++i) {
-        tt_entry_t *entry = &table->files[i];
-        if (cbstr_cmp(&entry->file_name, file) && cbstr_cmp(&entry->parent_dirs, parent)) {
-            return entry;
+        memcpy(&table->files[i], data + i * TT_V7_ENTRY_SIZE, TT_V7_ENTRY_SIZE);
+        table->files[i].used = generation;
+        table->files[i].reserved = 0;
+    }
+
+    printf("[INFO] Migrated version 7 timetable.\n");
+    table->dirty = true;
+}
+
+bool tt_load(tt_t *table, const char *path) {
+    file_map_t map;
+    tt_header_t *header;
+    size_t entry_size;
+    size_t expected;
+    char *data;
+
+    if (!file_map(path, &map)) {
+        *table = tt_init(4);
+        return false;
+    }
+
+    header = map.data;
+
+    if (map.size < sizeof(uint16_t) * 2 || header->magic != TT_MAGIC) {
+        file_unmap(&map);
+        *table = tt_init(4);
+        eprintf("[WARNING] Invalid timetable file, skipping incremental compilation...\n");
+        return true;
+    }
+
+    if (header->version == 3 || header->version == 4) {
+        uint16_t version = header->version;
+        FILE *file;
+
+        file_unmap(&map);
+        file = fopen(path, "rb");
+
+        if (!file) {
+            *table = tt_init(4);
+            return false;
         }
+
+        fseek(file, sizeof(uint16_t) * 2, SEEK_SET);
+        tt_migrate(table, file, version);
+        fclose(file);
+        return true;
     }
 
-    return NULL;
+    if (header->version != TT_VERSION && header->version != 7) {
+        file_unmap(&map);
+        *table = tt_init(4);
+        eprintf("[WARNING] Outdated timetable file, skipping incremental compilation...\n");
+        return true;
+    }
+
+    entry_size = header->version == 7 ? TT_V7_ENTRY_SIZE : sizeof(tt_entry_t);
+    expected = map.size < sizeof(tt_header_t) ? 0 : sizeof(tt_header_t)
+        + (size_t)header->entries * entry_size
+        + (size_t)header->deps * sizeof(tt_dep_t)
+        + (size_t)header->files_index * sizeof(tt_slot_t)
+        + (size_t)header->deps_index * sizeof(tt_slot_t)
+        + (size_t)header->dep_lists * sizeof(uint32_t)
+        + header->strings;
+
+    if (expected == 0 || map.size < expected
+        || header->files_index == 0 || (header->files_index & (header->files_index - 1)) != 0
+        || header->deps_index == 0 || (header->deps_index & (header->deps_index - 1)) != 0) {
+        file_unmap(&map);
+        *table = tt_init(4);
+        eprintf("[WARNING] Invalid timetable file, skipping incremental compilation...\n");
+        return true;
+    }
+
+    // Everything is used straight out of the mapping, nothing is copied until it changes
+    data = (char*)map.data + sizeof(tt_header_t);
+
+    table->files = (tt_entry_t*)data;
+    table->len = header->entries;
+    table->capacity = 0;
+    table->dirty = false;
+
+    if (header->version == 7) {
+        tt_upgrade_entries(table, data, header->generation);
+    }
+
+    data += table->len * entry_size;
+
+    table->deps = (tt_dep_t*)data;
+    table->deps_len = header->deps;
+    table->deps_capacity = 0;
+    data += table->deps_len * sizeof(tt_dep_t);
+
+    table->files_index.slots = (tt_slot_t*)data;
+    table->files_index.capacity = header->files_index;
+    table->files_index.owned = false;
+    data += table->files_index.capacity * sizeof(tt_slot_t);
+
+    table->deps_index.slots = (tt_slot_t*)data;
+    table->deps_index.capacity = header->deps_index;
+    table->deps_index.owned = false;
+    data += table->deps_index.capacity * sizeof(tt_slot_t);
+
+    table->dep_lists = (uint32_t*)data;
+    table->dep_lists_len = header->dep_lists;
+    table->dep_lists_capacity = 0;
+    data += table->dep_lists_len * sizeof(uint32_t);
+
+    table->strings = data;
+    table->strings_len = header->strings;
+    table->strings_capacity = 0;
+    table->garbage = 0;
+
+    table->generation = header->generation;
+    table->map = map;
+
+    return true;
 }
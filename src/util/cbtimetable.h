@@ -12,76 +12,181 @@
 #include "../mem/cbmem.h"
 #include "../util/cbstr.h"
 #include "../os/time.h"
+#include "../os/map.h"
 
-#define TT_VERSION 3
+#define TT_VERSION 8
 #define TT_MAGIC 0x5474
 
 // Timetable file structure
-// +----------------------+---------+
-// | Magic Number - 54 74 | 2 Bytes |
-// +----------------------+---------+
-// | File Version         | 2 Bytes |
-// +----------------------+---------+
-// | Number of entries    | 4 Bytes |
-// +----------------------+---------+
-// | Build success status | 1 Byte  |
-// +----------------------+---------+
-// | Entries              | Varies  |
-// +----------------------+---------+
+// The file is mapped and used in place, so every section is an array of the
+// matching in-memory struct and sections refer to each other by index.
+// +----------------------+--------------------+
+// | File header          | 40 Bytes           |
+// +----------------------+--------------------+
+// | Entries              | 64 Bytes per entry |
+// +----------------------+--------------------+
+// | Headers              | 40 Bytes per entry |
+// +----------------------+--------------------+
+// | Entry hash index     | 8 Bytes per slot   |
+// +----------------------+--------------------+
+// | Header hash index    | 8 Bytes per slot   |
+// +----------------------+--------------------+
+// | Header lists         | 4 Bytes per index  |
+// +----------------------+--------------------+
+// | String table         | Varies             |
+// +----------------------+--------------------+
 //
-// Timetable entry structure
-// Note - all strings are length-prefixed (4 bytes) and null-terminated
-// +----------------------+---------+
-// | Last write time      | 8 Bytes |
-// +----------------------+---------+
-// | File name            | String  |
-// +----------------------+---------+
-// | Parent directories   | String  |
-// +----------------------+---------+
-// | Object file          | String  |
-// +----------------------+---------+
+// Note - strings in the string table are length-prefixed (4 bytes) and
+// null-terminated, the length includes the terminator.
+//
+// Version 7 files are the same without the `used` generation of each entry and
+// are upgraded when loaded. Only the generation is kept from version 3 and 4
+// files, they have no command hashes so nothing in them could be found again.
+//
+// One timetable is shared by every rule, entries are told apart by the hash of
+// the command that built them. Entries no build has looked up in
+// TT_MAX_AGE generations are dropped when the table is saved, so switching
+// flags or compilers doesn't grow the file forever.
 
 typedef struct tt_header {
     uint16_t magic;
     uint16_t version;
-    uint32_t size;
+    uint32_t entries;
+    uint32_t deps;
+    uint32_t files_index;
+    uint32_t deps_index;
+    uint32_t dep_lists;
+    uint32_t strings;
+    uint32_t generation;
+    uint8_t reserved[8];
 } tt_header_t;
 
+#define TT_SIZE_UNKNOWN UINT64_MAX
+#define TT_MAX_AGE 64
+
+// What a file looked like when it was recorded. The contents are only hashed
+// when the write time or size moves, so touching a file doesn't rebuild it.
+typedef struct tt_stamp {
+    // Nanoseconds since the epoch on unix, FILETIME ticks on windows
+    int64_t write_time;
+    uint64_t size;
+    uint64_t hash;
+} tt_stamp_t;
+
+// Headers are shared between every entry that includes them so each one
+// only has to be checked once per build.
+typedef struct tt_dep {
+    tt_stamp_t stamp;
+    // Generation of the last build that saw this header change
+    uint32_t changed;
+    // Generation of the last build that checked this header
+    uint32_t checked;
+    // Offset into the string table
+    uint32_t path;
+    uint32_t reserved;
+} tt_dep_t;
+
 typedef struct tt_entry {
-    time_t write_time;
+    tt_stamp_t stamp;
+    // Hash of the command the entry was built with, part of its key
+    uint64_t command;
+    // Generation of the last build that compiled this entry
+    uint32_t built;
 
+    // Offsets into the string table
     // Store name separately from directory to (maybe) speed up search (remind me to benchmark later)
-    cbstr_t file_name;
-    cbstr_t parent_dirs;
-
+    uint32_t file_name;
+    uint32_t parent_dirs;
     // This probably doesn't need to be stored but I will keep it in for now
-    cbstr_t obj_file;
+    uint32_t obj_file;
+
+    // Offset and length of this entry's list of header indices
+    uint32_t deps;
+    uint32_t dep_count;
+
+    // Generation of the last build that looked this entry up
+    uint32_t used;
+    uint32_t reserved;
 } tt_entry_t;
 
+// Open-addressing hash index, saved alongside the entries so loading never
+// has to rebuild it
+typedef struct tt_slot {
+    uint32_t hash;
+    // Item index + 1, 0 marks an empty slot
+    uint32_t item;
+} tt_slot_t;
+
+typedef struct tt_index {
+    tt_slot_t *slots;
+    // Always a power of two
+    size_t capacity;
+    // False while the slots still point into the mapped file
+    bool owned;
+} tt_index_t;
+
+// Every array in the table starts out pointing into the mapped file with a
+// capacity of 0 and is only copied to the heap the first time it has to grow.
 typedef struct tt {
     tt_entry_t *files;
     size_t len;
     size_t capacity;
-    bool build_success;
+    tt_index_t files_index;
+
+    tt_dep_t *deps;
+    size_t deps_len;
+    size_t deps_capacity;
+    tt_index_t deps_index;
+
+    uint32_t *dep_lists;
+    size_t dep_lists_len;
+    size_t dep_lists_capacity;
+
+    char *strings;
+    size_t strings_len;
+    size_t strings_capacity;
+    // Bytes of strings and header lists no longer referenced by anything
+    size_t garbage;
+
+    file_map_t map;
+    uint32_t generation;
+    // Whether anything needs to be written back
+    bool dirty;
 } tt_t;
 
 #ifdef DEBUG
-#define tt_entry_free(entry) d_tt_entry_free(entry, __FILE__, __LINE__)
 #define tt_init(cap) d_tt_init(cap, __FILE__, __LINE__)
 #define tt_free(table) d_tt_free(table, __FILE__, __LINE__)
 #endif /* DEBUG */
 
 #ifdef RELEASE
-#define tt_entry_free(entry) d_tt_entry_free(entry)
 #define tt_init(cap) d_tt_init(cap)
 #define tt_free(table) d_tt_free(table)
 #endif /* RELEASE */
 
-void ALLOC_DEF(tt_entry_free, tt_entry_t *entry);
 tt_t ALLOC_DEF(tt_init, size_t cap);
 void ALLOC_DEF(tt_free, tt_t *table);
 
-void tt_push(tt_t *table, tt_entry_t entry);
-void tt_save(tt_t *table, FILE *file);
-void tt_load(tt_t *table, FILE *file);
-tt_entry_t *tt_search(tt_t *table, cbstr_t *file, cbstr_t *parent);
+// Returns false if the file could not be opened, the table is left empty
+// either way if the file could not be used.
+bool tt_load(tt_t *table, const char *path);
+// Only writes the file if something changed since it was loaded.
+void tt_save(tt_t *table, const char *path);
+
+tt_entry_t *tt_search(tt_t *table, cbstr_t *file, cbstr_t *parent, uint64_t command);
+// Returns a view into the string table, it must not be freed or grown.
+cbstr_t tt_string(tt_t *table, uint32_t offset);
+
+// Records a successful compile of `file` by `command`, `deps` are the headers
+// it included.
+void tt_record(tt_t *table, cbstr_t *file, cbstr_t *parent, uint64_t command, cbstr_t *object, tt_stamp_t *stamp, cbstr_list_t *deps);
+
+// Starts a new build generation, every header will be checked again.
+void tt_begin_build(tt_t *table);
+// Whether the contents of the source file changed since it was last built.
+bool tt_entry_source_changed(tt_t *table, tt_entry_t *entry, const char *path, int64_t write_time, uint64_t size);
+// Whether any header included by the entry changed since it was last built.
+bool tt_entry_deps_changed(tt_t *table, tt_entry_t *entry);
+// Whether the header at `index` of the entry's list changed since it was last
+// built, `path` is set to a view of the header's path.
+bool tt_entry_dep_changed(tt_t *table, tt_entry_t *entry, uint32_t index, cbstr_t *path);
@@ -0,0 +1,159 @@
+/// Author - zebubull
+/// cbtoolchain.c
+/// cbtoolchain.h implementation.
+/// Copyright (c) zebubull 2023
+#include "cbtoolchain.h"
+
+#include "cbhash.h"
+#include "cblog.h"
+#include "../os/dir.h"
+#include "../os/proc.h"
+#include "../mem/cbmem.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// Hashes where a program is, its size and write time into `hash`. Returns
+// false if it isn't on the PATH.
+static bool program_hash(const char *name, cbstr_t *path, uint64_t *hash) {
+    int64_t write_time;
+    uint64_t size;
+
+    *hash = cbhash_bytes(name, strlen(name), *hash);
+
+    if (!proc_find_program(name, path) || !file_stat(path->data, &write_time, &size)) {
+        return false;
+    }
+
+    *hash = cbhash_bytes(path->data, path->len, *hash);
+    *hash = cbhash_bytes(&write_time, sizeof(write_time), *hash);
+    *hash = cbhash_bytes(&size, sizeof(size), *hash);
+    return true;
+}
+
+// Each line of the cache is `<key> <fuse_ld> <version>`
+static bool load_probe(cbtoolchain_t *toolchain, uint64_t key, const char *cache) {
+    char line[512];
+    unsigned long long found;
+    int fuse_ld;
+    int offset;
+    size_t len;
+    FILE *file = fopen(cache, "rb");
+
+    if (file == NULL) {
+        return false;
+    }
+
+    while (fgets(line, sizeof(line), file) != NULL) {
+        if (sscanf(line, "%16llx %d %n", &found, &fuse_ld, &offset) != 2 || found != key) continue;
+
+        len = strcspn(line + offset, "\r\n");
+        cbstr_clear(&toolchain->version);
+        cbstr_concat_cstr(&toolchain->version, line + offset, len);
+        toolchain->fuse_ld = fuse_ld != 0;
+
+        fclose(file);
+        return true;
+    }
+
+    fclose(file);
+    return false;
+}
+
+static void save_probe(cbtoolchain_t *toolchain, uint64_t key, const char *cache) {
+    FILE *file = fopen(cache, "ab");
+
+    if (file == NULL) {
+        eprintf("[WARNING] Could not write '%s', the toolchain will be probed again next build.\n", cache);
+        return;
+    }
+
+    fprintf(file, "%016llx %d %s\n", (unsigned long long)key, toolchain->fuse_ld, toolchain->version.len != 0 ? toolchain->version.data : "");
+    fclose(file);
+}
+
+static bool run_probe(cbtoolchain_t *toolchain, const char *cc, const char *ld, const char *linker) {
+    cbstr_t output = cbstr_with_cap(256);
+    cbstr_t fuse_ld = cbstr_with_cap(32);
+    proc_status_t status;
+    char *argv[4];
+    size_t len;
+
+    argv[0] = (char*)cc;
+    argv[1] = "--version";
+    argv[2] = NULL;
+
+    if (!proc_run(argv, &output, &status) || status.code != 0) {
+        cbstr_free(&fuse_ld);
+        cbstr_free(&output);
+        return false;
+    }
+
+    len = output.len != 0 ? strcspn(output.data, "\r\n") : 0;
+    cbstr_clear(&toolchain->version);
+    cbstr_concat_cstr(&toolchain->version, output.data, len);
+
+    toolchain->fuse_ld = true;
+
+    if (linker != NULL) {
+        cbstr_concat_cstr(&fuse_ld, CB_CSTR("-fuse-ld="));
+        cbstr_concat_cstr(&fuse_ld, linker, strlen(linker));
+
+        // Only the linker's version is asked for, so nothing gets linked
+        argv[0] = (char*)ld;
+        argv[1] = fuse_ld.data;
+        #ifdef __APPLE__
+        argv[2] = "-Wl,-v";
+        #else
+        argv[2] = "-Wl,--version";
+        #endif /* __APPLE__ */
+        argv[3] = NULL;
+
+        toolchain->fuse_ld = proc_run(argv, &output, &status) && status.code == 0;
+    }
+
+    printf("[INFO] Probed %s: %s\n", cc, toolchain->version.len != 0 ? toolchain->version.data : "unknown version");
+
+    cbstr_free(&fuse_ld);
+    cbstr_free(&output);
+    return true;
+}
+
+bool cbtoolchain_probe(cbtoolchain_t *toolchain, const char *cc, const char *ld, const char *linker, const char *cache) {
+    cbstr_t path = cbstr_with_cap(128);
+    uint64_t key;
+    bool found;
+
+    toolchain->version = cbstr_with_cap(64);
+    toolchain->fuse_ld = true;
+    toolchain->clang = false;
+    toolchain->compiler = CBHASH_SEED;
+
+    // Nothing to key the answers by without the compiler's write time
+    found = program_hash(cc, &path, &toolchain->compiler);
+
+    key = toolchain->compiler;
+    program_hash(ld, &path, &key);
+    if (linker != NULL) {
+        key = cbhash_bytes(linker, strlen(linker), key);
+    }
+
+    cbstr_free(&path);
+
+    if (!found || !load_probe(toolchain, key, cache)) {
+        if (!run_probe(toolchain, cc, ld, linker)) {
+            return false;
+        }
+
+        if (found) {
+            save_probe(toolchain, key, cache);
+        }
+    }
+
+    toolchain->clang = strstr(toolchain->version.data, "clang") != NULL;
+    return true;
+}
+
+void cbtoolchain_free(cbtoolchain_t *toolchain) {
+    cbstr_free(&toolchain->version);
+}
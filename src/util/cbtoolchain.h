@@ -0,0 +1,29 @@
+/// Author - zebubull
+/// cbtoolchain.h
+/// A header for finding out what the compiler and linker can do.
+/// Copyright (c) zebubull 2023
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "cbstr.h"
+
+typedef struct cbtoolchain {
+    // Hash of where the compiler is, its size and write time
+    uint64_t compiler;
+    // First line of `cc --version`
+    cbstr_t version;
+    // Whether the compiler is clang rather than gcc, going by its version
+    bool clang;
+    // Whether the link driver takes -fuse-ld for the linker asked for, always
+    // true without one
+    bool fuse_ld;
+} cbtoolchain_t;
+
+// Finds out about compiling with `cc` and linking with `ld` given
+// -fuse-ld=`linker`, `linker` may be NULL. The programs are only run the first
+// time they are seen, the answers are kept in `cache` keyed by where they are
+// and when they were written. Returns false if `cc` couldn't be run.
+bool cbtoolchain_probe(cbtoolchain_t *toolchain, const char *cc, const char *ld, const char *linker, const char *cache);
+void cbtoolchain_free(cbtoolchain_t *toolchain);
@@ -0,0 +1,106 @@
+/// Author - zebubull
+/// cbtrace.c
+/// cbtrace.h implementation.
+/// Copyright (c) zebubull 2023
+#include "cbtrace.h"
+
+#include <stdio.h>
+
+#include "../os/time.h"
+
+// Every event goes into one array, the closing bracket is optional in the
+// format so a trace from a killed watch session still loads.
+static FILE *trace_file = NULL;
+static int64_t trace_start;
+static bool trace_first;
+// Worker tracks that have been given a name so far
+static size_t named_slots;
+
+bool cbtrace_open(const char *path, int64_t origin) {
+    trace_file = fopen(path, "wb");
+
+    if (trace_file == NULL) {
+        return false;
+    }
+
+    trace_start = origin;
+    trace_first = true;
+    named_slots = 0;
+    fputs("[\n", trace_file);
+
+    // Names the tracks so they don't just show up as numbers
+    fputs("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"cbuild\"}}", trace_file);
+    trace_first = false;
+
+    return true;
+}
+
+void cbtrace_close() {
+    if (trace_file == NULL) {
+        return;
+    }
+
+    fputs("\n]\n", trace_file);
+    fclose(trace_file);
+    trace_file = NULL;
+}
+
+bool cbtrace_enabled() {
+    return trace_file != NULL;
+}
+
+static void write_string(const char *str) {
+    fputc('"', trace_file);
+
+    for (; *str != 0; ++str) {
+        if (*str == '"' || *str == '\\') {
+            fputc('\\', trace_file);
+            fputc(*str, trace_file);
+        } else if ((unsigned char)*str < 0x20) {
+            fprintf(trace_file, "\\u%04x", *str);
+        } else {
+            fputc(*str, trace_file);
+        }
+    }
+
+    fputc('"', trace_file);
+}
+
+// Opens a complete event, the caller finishes it after the args
+static void begin_event(const char *name, const char *category, int64_t start, int64_t end, size_t tid) {
+    fputs(trace_first ? "\n" : ",\n", trace_file);
+    trace_first = false;
+
+    fputs("{\"name\":", trace_file);
+    write_string(name);
+    // Timestamps are in microseconds
+    fprintf(trace_file, ",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f",
+        category, (unsigned)tid, (start - trace_start) / 1000.0, (end - start) / 1000.0);
+}
+
+void cbtrace_phase(const char *name, int64_t start, int64_t end) {
+    if (trace_file == NULL) {
+        return;
+    }
+
+    begin_event(name, "phase", start, end, 0);
+    fputs("}", trace_file);
+    // Phases are rare enough to flush after each, watch mode never closes the file
+    fflush(trace_file);
+}
+
+void cbtrace_job(const char *name, const char *file, int64_t start, int64_t end, size_t slot, int code) {
+    if (trace_file == NULL) {
+        return;
+    }
+
+    for (; named_slots <= slot; ++named_slots) {
+        fprintf(trace_file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"worker %u\"}}", (unsigned)named_slots + 1, (unsigned)named_slots);
+    }
+
+    // Track 0 is the main thread's
+    begin_event(name, "job", start, end, slot + 1);
+    fputs(",\"args\":{\"file\":", trace_file);
+    write_string(file);
+    fprintf(trace_file, ",\"slot\":%u,\"code\":%d}}", (unsigned)slot, code);
+}
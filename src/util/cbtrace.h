@@ -0,0 +1,24 @@
+/// Author - zebubull
+/// cbtrace.h
+/// A header for writing build timelines in the chrome trace event format.
+/// Copyright (c) zebubull 2023
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Nothing is written until cbtrace_open succeeds, so every call is safe to
+// make whether tracing is on or not. Times come from monotonic_ns.
+
+// Times in the trace are relative to `origin`. Returns false if the file
+// could not be created.
+bool cbtrace_open(const char *path, int64_t origin);
+void cbtrace_close();
+bool cbtrace_enabled();
+
+// A span on the main thread's track, spans that start inside another span
+// are shown nested under it.
+void cbtrace_phase(const char *name, int64_t start, int64_t end);
+// A compiler or linker run, shown on the track of the worker slot it ran in.
+void cbtrace_job(const char *name, const char *file, int64_t start, int64_t end, size_t slot, int code);